@@ -2,6 +2,7 @@
 
 #include <string>
 #include <iostream>
+#include <atomic>
 #include <boost/asio.hpp>
 
 using boost::asio::ip::tcp;
@@ -12,6 +13,7 @@ private:
 	const short port_;
 	boost::asio::io_service io_service_;   // Provides core I/O functionality
 	tcp::socket socket_;
+	std::atomic<bool> closing_;             // the connection is expected to end, failed reads and writes are not reported
 
 public:
 	ConnectionHandler(std::string host, short port);
@@ -48,4 +50,12 @@ public:
 	// Close down the connection properly.
 	void close();
 
+	// Note that the remote host is about to close the connection, e.g. after a DISCONNECT.
+	// Reads and writes still fail once it does, but without reporting an error.
+	void expectClose();
+
+	// Stop both directions of the connection, may be called from another thread. A reader blocked in
+	// getBytes returns false, without reporting the error, as does every read or write after it.
+	void shutdown();
+
 }; //class ConnectionHandler
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../include/event.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+// Compact binary encoding of Event and GameStats.
+//
+// Layout (all integers are unsigned LEB128 varints, i.e. little-endian base 128):
+//   magic "SEVB", version byte, kind byte (1 = Event, 2 = GameStats, 3 = names_and_events,
+//   4 = summary)
+//   key table: count, then (length, bytes) for every distinct update key
+//   payload:   strings are (length, bytes), update maps are count then (key index, value)
+//              pairs, the event time is zigzag encoded
+// A GameStats payload is its three stats maps followed by the event count and the events,
+// all sharing the one key table. A names_and_events payload is the two team names, the event
+// count and the events. A summary payload is the game name, the user, the two team names and
+// the number of events evicted before those it holds, then a GameStats payload.
+//
+// Decoders throw std::runtime_error on malformed or unsupported input.
+
+const unsigned char EVENT_CODEC_VERSION = 1;
+
+// The update keys of one record, numbered in the order they are first used. A record encoded
+// in parts keeps one table across them; keys are only ever added, so parts encoded earlier
+// stay valid.
+class EventKeyTable
+{
+private:
+    std::map<std::string, uint64_t> index;
+    std::vector<const std::string *> keys;
+
+public:
+    EventKeyTable();
+    // keys points into index, which a copy would not share
+    EventKeyTable(const EventKeyTable &) = delete;
+    EventKeyTable &operator=(const EventKeyTable &) = delete;
+    EventKeyTable(EventKeyTable &&) = default;
+    EventKeyTable &operator=(EventKeyTable &&) = default;
+
+    // the number of the key, added if it is new
+    uint64_t intern(const char *data, size_t size);
+    // appends the key count and the keys
+    void put(std::string &out) const;
+};
+
+// One user's summary of a game, see the layout above
+struct SummaryRecord
+{
+    std::string gameName;
+    std::string user;
+    std::string teamA;
+    std::string teamB;
+    uint64_t evicted;
+    GameStats stats;
+
+    SummaryRecord() : gameName(), user(), teamA(), teamB(), evicted(0), stats() {}
+};
+
+std::string encodeEvent(const Event &event);
+Event decodeEvent(const std::string &buffer);
+
+std::string encodeGameStats(const GameStats &stats);
+GameStats decodeGameStats(const std::string &buffer);
+
+std::string encodeReport(const names_and_events &report);
+names_and_events decodeReport(const std::string &buffer);
+
+std::string encodeSummary(const SummaryRecord &summary);
+SummaryRecord decodeSummary(const std::string &buffer);
+
+// A summary in parts, for writers that keep the encoded events: each event is appended to the
+// events' part once with encodeSummaryEvent, and the record is the head followed by that part.
+// The head covers everything else, including the key table and the number of events in stats,
+// so it is encoded last, with the same keys.
+void encodeSummaryEvent(EventKeyTable &keys, const Event &event, std::string &out);
+std::string encodeSummaryHead(EventKeyTable &keys, const std::string &gameName, const std::string &user,
+                              const std::string &teamA, const std::string &teamB, uint64_t evicted,
+                              const GameStats &stats);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../include/event.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+
+// Index of one game's stored events by game time, by event name then game time, and by user
+// then game time, so queries cost a lookup plus the matches instead of a scan of the game's history.
+// Entries do not point at events directly, since inserting into or evicting from an event
+// deque moves them; an entry names the deque and the event's sort key, and is resolved with
+// a binary search when a query hits it. The time indexes allocate from the game's arena when
+// given one. Not synchronized; callers hold the game's lock.
+class EventIndex
+{
+public:
+    struct Hit
+    {
+        const std::string *user;
+        const Event *event;
+    };
+
+    explicit EventIndex(GameArena *arena = nullptr);
+
+    EventIndex(const EventIndex &) = delete;
+    EventIndex &operator=(const EventIndex &) = delete;
+    EventIndex(EventIndex &&) = default;
+    EventIndex &operator=(EventIndex &&) = default;
+
+    // user must outlive its entries, as a key of a node-based map does
+    void add(const std::string &user, const EventList &events, const Event &event);
+    void remove(const EventList &events, const Event &event);
+
+    // Events with from <= time <= to whose name contains nameFilter (ignoring case, empty
+    // matches all), reported by user if it is not empty, ordered by time
+    std::vector<Hit> query(int from, int to, const std::string &nameFilter, const std::string &user) const;
+
+    size_t size() const;
+    // estimate of the bytes held by the index's nodes and its name and user tables
+    size_t memoryUsage() const;
+
+    // Leaves the nodes to the arena, which must be on its way out, emptying the index without
+    // a walk over its entries
+    void abandon();
+
+private:
+    struct Entry
+    {
+        const std::string *user;
+        const EventList *events;
+        uint64_t sortKey;
+    };
+    typedef std::multimap<int, Entry, std::less<int>, ArenaAllocator<std::pair<const int, Entry>>> TimeIndex;
+
+    GameArena *arena;
+    TimeIndex byTime;
+    // lower-cased event name -> that name's events by time
+    std::unordered_map<std::string, TimeIndex> byName;
+    // user -> that user's events by time
+    std::unordered_map<std::string, TimeIndex> byUser;
+
+    static std::string lower(const char *text, size_t size);
+    TimeIndex &timeIndex(std::unordered_map<std::string, TimeIndex> &indexes, const std::string &key);
+    static const std::string *erase(TimeIndex &index, const EventList &events, const Event &event);
+    static void eraseFrom(std::unordered_map<std::string, TimeIndex> &indexes, const std::string &key,
+                          const EventList &events, const Event &event);
+    static void collect(const TimeIndex &index, int from, int to, const std::string &needle, std::vector<Hit> &hits);
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "../include/event.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+// Append-only log of the events received from the server, so stored game data survives a
+// restart. The log is a directory of numbered segment files, one directory per logged in user;
+// every log opened appends to a fresh segment and a segment is closed once it passes SEGMENT_BYTES.
+// Logging is opt-in: the user directories live under $STOMP_EVENT_LOG, and nothing is logged
+// without it. Replay trusts what it reads, so the base and user directories must be private to
+// the user running the client (see PrivateDirectory.h), otherwise logging is disabled.
+//
+// Record layout: payload length (4 bytes LE), CRC-32 of the payload (4 bytes LE), payload.
+// A payload is a kind byte followed by length-prefixed (4 bytes LE) fields:
+//   kind 1 (event):      game name, user, event in the binary event encoding
+//   kind 2 (release):    game name, its stored data was dropped
+//   kind 3 (evict):      game name, user, count: the user's oldest count events were evicted
+//   kind 4 (checkpoint): no fields, everything logged before it is superseded by what follows
+//   kind 5 (stats):      game name, user, team a, team b, evicted count, the user's game stats
+//                        in the binary game stats encoding, without events
+//
+// A checkpoint rewrites the log as the records of the state it holds, then deletes the segments
+// before it, so the log stays proportional to the data held rather than to its history.
+//
+// Appends only copy the record into a buffer. A background thread commits the buffer with one
+// write and one fdatasync every GROUP_COMMIT_INTERVAL, or sooner once GROUP_COMMIT_BYTES are
+// pending, so a crash loses at most the last group. Replay reads a segment up to its first torn
+// or corrupt record and moves on to the next one. Safe to use from several threads.
+class EventLog
+{
+private:
+    static const size_t SEGMENT_BYTES = 64 * 1024 * 1024;
+    static const size_t GROUP_COMMIT_BYTES = 1024 * 1024;
+    static const std::chrono::milliseconds GROUP_COMMIT_INTERVAL;
+
+    enum RecordKind { RECORD_EVENT = 1, RECORD_RELEASE = 2, RECORD_EVICT = 3, RECORD_CHECKPOINT = 4, RECORD_STATS = 5 };
+
+    std::string directory;
+    int lockFd;
+    int segmentFd;
+    size_t segmentSize;
+    unsigned nextSegment;
+    // the first segment this log writes, those before it were there when it was opened
+    unsigned firstSegment;
+
+    // records appended but not yet committed, and how many bytes were appended and committed so far
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable committed;
+    std::string pending;
+    unsigned long long appendedBytes;
+    unsigned long long committedBytes;
+    bool flushing;
+    bool closing;
+    bool failed;
+    std::thread writer;
+
+    void append(RecordKind kind, const std::vector<const std::string *> &fields);
+    void writeLoop();
+    bool openSegment();
+    std::vector<std::string> segmentPaths();
+    static unsigned segmentNumber(const std::string &path);
+
+public:
+    // What replay feeds the logged records to, one function per record kind
+    struct Handlers
+    {
+        std::function<void(const std::string &gameName, const std::string &user, Event &event)> event;
+        std::function<void(const std::string &gameName)> release;
+        std::function<void(const std::string &gameName, const std::string &user, size_t count)> evict;
+        std::function<void()> checkpoint;
+        std::function<void(const std::string &gameName, const std::string &user, const std::string &teamA,
+                           const std::string &teamB, size_t evicted, GameStats &stats)> stats;
+
+        Handlers() : event(), release(), evict(), checkpoint(), stats() {}
+    };
+
+    struct ReplayCounts
+    {
+        size_t events;
+        size_t records;
+        size_t segments;
+    };
+
+    // directory to keep the log in, created if need be; an empty string, or a directory that is
+    // not private to the user, disables logging
+    explicit EventLog(const std::string &directory);
+    // commits whatever is pending
+    ~EventLog();
+
+    EventLog(const EventLog &) = delete;
+    EventLog &operator=(const EventLog &) = delete;
+
+    // $STOMP_EVENT_LOG, an empty string if it is not set
+    static std::string defaultDirectory();
+    // The log directory of user under the default directory, which is created if need be;
+    // an empty string if logging is disabled or the default directory is not private
+    static std::string userDirectory(const std::string &user);
+
+    bool enabled() const;
+
+    // Feeds every logged record, oldest first, to its handler
+    ReplayCounts replay(const Handlers &handlers);
+
+    void appendEvent(const std::string &gameName, const std::string &user, const Event &event);
+    void appendRelease(const std::string &gameName);
+    void appendEvict(const std::string &gameName, const std::string &user, size_t count);
+    void appendStats(const std::string &gameName, const std::string &user, const std::string &teamA,
+                     const std::string &teamB, size_t evicted, const GameStats &stats);
+
+    // Writes a checkpoint record followed by whatever writeState appends, waits until it is on
+    // disk and deletes the segments that were there when the log was opened. A crash in between
+    // leaves both, which replay the same since the checkpoint supersedes what came before it.
+    void checkpoint(const std::function<void()> &writeState);
+
+    // Commits everything appended so far and waits until it is on disk; false if any write of
+    // this log failed
+    bool flush();
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "../include/event.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <utility>
+#include <memory>
+
+// Orders an unbounded stream of events by sort key using bounded memory. Events are buffered
+// up to a window; every full window is sorted and spilled to a temporary run file, and the
+// runs are k-way merged when the events are read back. Run records keep the original sort key,
+// so ties keep their arrival order across runs. Each run owns its file and removes it when it
+// goes, so no run file outlives the sorter, even when a spill or merge throws.
+class ExternalEventSorter
+{
+private:
+    struct Run
+    {
+        std::string path;
+        std::ifstream in;
+        bool hasHead;
+        uint64_t headKey;
+        std::string headRecord;
+
+        Run() : path(), in(), hasHead(false), headKey(0), headRecord() {}
+        ~Run();
+    };
+    typedef std::vector<std::unique_ptr<Run>> RunGroup;
+
+    // (head sort key, index into the run group being merged) min-heap entries
+    typedef std::pair<uint64_t, size_t> HeapEntry;
+
+    // most runs read at once, keeps open files and read buffers bounded
+    static const size_t MAX_FAN_IN = 64;
+
+    size_t windowEvents;
+    std::string directory;
+    std::vector<Event> window;
+    RunGroup runs;
+    std::vector<HeapEntry> heap;
+    size_t nextRunId;
+    size_t windowPos;
+    bool finished;
+
+    void spill();
+    void advance(Run &run);
+    void openRuns(RunGroup &group);
+    bool popSmallest(size_t &index);
+    void pushNext(RunGroup &group, size_t index);
+    void reduceRuns();
+
+public:
+    explicit ExternalEventSorter(size_t windowEvents);
+    ExternalEventSorter(const ExternalEventSorter &) = delete;
+    ExternalEventSorter &operator=(const ExternalEventSorter &) = delete;
+    ~ExternalEventSorter();
+
+    void add(Event &event);
+    // Call once after the last add()
+    void finish();
+    // Appends up to max events in sort key order to out, returns false once the events are exhausted
+    bool next(std::vector<Event> &out, size_t max);
+    size_t runCount() const;
+};
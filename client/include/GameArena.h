@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+// Bump allocator holding one game's stored events: their strings, update maps, the deque
+// blocks and the index nodes. Memory comes in chunks mapped straight from the kernel, growing
+// from CHUNK_MIN_BYTES to CHUNK_MAX_BYTES, and is only returned when the arena goes, so releasing
+// a game unmaps a handful of chunks instead of freeing every allocation. Freed blocks are just
+// counted; owners rebuild into a fresh arena once too much of it is dead. With
+// $STOMP_ARENA_HUGEPAGES set, full size chunks are 2 MB aligned and backed by huge pages where
+// the kernel provides them. Not synchronized; callers hold the game's lock.
+class GameArena
+{
+private:
+    static const size_t CHUNK_MIN_BYTES = 64 * 1024;
+    static const size_t CHUNK_MAX_BYTES = 2 * 1024 * 1024;
+
+    struct Chunk
+    {
+        char *base;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    char *cursor;
+    char *limit;
+    size_t nextChunk;
+    bool hugePages;
+    size_t reserved;
+    size_t used;
+    size_t released;
+
+    char *addChunk(size_t dedicatedBytes);
+
+public:
+    explicit GameArena(bool hugePages = hugePagesRequested());
+    ~GameArena();
+
+    GameArena(const GameArena &) = delete;
+    GameArena &operator=(const GameArena &) = delete;
+
+    // whether $STOMP_ARENA_HUGEPAGES asks for huge page backed chunks
+    static bool hugePagesRequested();
+
+    void *allocate(size_t bytes, size_t alignment);
+    void deallocate(size_t bytes) { released += bytes; }
+
+    // Moves value into the arena and never destroys it. For containers whose every allocation
+    // came from this arena: their memory goes back with the arena's chunks, without a walk over
+    // their elements. value is left empty.
+    template <typename T>
+    void abandon(T &value)
+    {
+        new (allocate(sizeof(T), alignof(T))) T(std::move(value));
+    }
+
+    // bytes mapped, handed out, and handed back
+    size_t reservedBytes() const { return reserved; }
+    size_t usedBytes() const { return used; }
+    size_t releasedBytes() const { return released; }
+};
+
+// Stateful allocator over a GameArena. A null arena allocates from the heap, which is what every
+// event outside a game's storage uses. Copying a container does not carry the arena along, so a
+// copy taken out of a game's storage never allocates from an arena it cannot lock.
+template <typename T>
+class ArenaAllocator
+{
+private:
+    GameArena *arena;
+
+    template <typename U>
+    friend class ArenaAllocator;
+
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator() : arena(nullptr) {}
+    explicit ArenaAllocator(GameArena *arena) : arena(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t n)
+    {
+        if (arena == nullptr)
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        if (arena == nullptr)
+            ::operator delete(p);
+        else
+            arena->deallocate(n * sizeof(T));
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+};
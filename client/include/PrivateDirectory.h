@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+// Directories for what the client keeps between runs. Their contents are trusted when read back,
+// so a directory is only used if it belongs to the user running the client and no one else can
+// read or write it; a location under a shared directory such as /tmp could have been created by
+// another user first.
+
+// $XDG_CACHE_HOME/stomp-client/name, or ~/.cache/stomp-client/name without it; an empty string
+// if neither variable is set
+std::string userCacheDirectory(const std::string &name);
+
+// Creates path with mode 0700 if it does not exist, its missing parents included. True if path
+// then is a directory, not a symlink to one, owned by the calling user with mode 0700.
+bool makePrivateDirectory(const std::string &path);
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+
+// Table of outstanding receipts indexed by receipt id. Ids are handed out by a counter and
+// confirmed roughly in order, so the live ids span a narrow window and id modulo capacity
+// addresses a slot directly. When a new id lands on a slot still in use, the table doubles
+// until the window fits again. Not synchronized; callers hold the session lock.
+template <typename T>
+class ReceiptRing
+{
+private:
+    struct Slot
+    {
+        int id;
+        bool used;
+        T value;
+
+        Slot() : id(0), used(false), value() {}
+    };
+
+    std::vector<Slot> slots;
+    size_t mask;
+    size_t count;
+    size_t initialCapacity;
+
+    Slot &slotFor(int id) { return slots[(unsigned)id & mask]; }
+
+    // whether every used id has a slot of its own at capacity; taken is scratch space
+    bool fitsIn(size_t capacity, std::vector<bool> &taken) const
+    {
+        taken.assign(capacity, false);
+        for (const Slot &slot : slots)
+        {
+            if (!slot.used)
+                continue;
+            size_t index = (unsigned)slot.id & (capacity - 1);
+            if (taken[index])
+                return false;
+            taken[index] = true;
+        }
+        return true;
+    }
+
+    // Doubles the table until the used ids fit, then moves the entries over. The capacity is
+    // settled on the ids alone, so each value is moved exactly once.
+    void grow()
+    {
+        size_t capacity = slots.size() * 2;
+        std::vector<bool> taken;
+        while (!fitsIn(capacity, taken))
+            capacity *= 2;
+
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+        mask = capacity - 1;
+        for (Slot &slot : old)
+        {
+            if (!slot.used)
+                continue;
+            Slot &target = slotFor(slot.id);
+            target.id = slot.id;
+            target.used = true;
+            target.value = std::move(slot.value);
+        }
+    }
+
+public:
+    // capacity must be a power of two
+    explicit ReceiptRing(size_t capacity = 64)
+        : slots(capacity), mask(capacity - 1), count(0), initialCapacity(capacity) {}
+
+    void insert(int id, T value)
+    {
+        while (slotFor(id).used && slotFor(id).id != id)
+            grow();
+        Slot &slot = slotFor(id);
+        if (!slot.used)
+            count++;
+        slot.id = id;
+        slot.used = true;
+        slot.value = std::move(value);
+    }
+
+    // Removes the entry for id, moving its value into value; false if id is not outstanding
+    bool take(int id, T &value)
+    {
+        Slot &slot = slotFor(id);
+        if (!slot.used || slot.id != id)
+            return false;
+        value = std::move(slot.value);
+        slot.used = false;
+        slot.value = T();
+        count--;
+        return true;
+    }
+
+    // Removes the entry for id; false if id is not outstanding
+    bool erase(int id)
+    {
+        T value;
+        return take(id, value);
+    }
+
+    // the outstanding ids, in no particular order
+    std::vector<int> ids() const
+    {
+        std::vector<int> result;
+        for (const Slot &slot : slots)
+            if (slot.used)
+                result.push_back(slot.id);
+        return result;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Removes every entry and gives back whatever the table grew to
+    void clear()
+    {
+        std::vector<Slot>(initialCapacity).swap(slots);
+        mask = initialCapacity - 1;
+        count = 0;
+    }
+};
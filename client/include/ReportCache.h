@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../include/event.h"
+#include <string>
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ctime>
+#include <sys/types.h>
+
+// Cache of parsed and sorted report files, kept in memory and mirrored on disk in the binary
+// event encoding. Entries are keyed by path and only served while the file's size and
+// modification time still match the ones it was parsed with. Reports are shared read-only, so a
+// hit hands out the cached report without copying it. The in-memory part holds at most
+// MEMORY_BYTES of events, dropping the least recently used reports first. The disk copies are
+// kept in a directory private to the user (see PrivateDirectory.h) and pruned after every save:
+// copies unused for DISK_MAX_AGE go, then the least recently used ones while they take more than
+// DISK_BYTES. Safe to use from several threads.
+class ReportCache
+{
+public:
+    typedef std::shared_ptr<const names_and_events> Report;
+
+    // size and modification time of a file, taken before it is read
+    struct FileStamp
+    {
+        off_t size;
+        time_t mtimeSec;
+        long mtimeNsec;
+
+        FileStamp() : size(0), mtimeSec(0), mtimeNsec(0) {}
+        bool operator==(const FileStamp &other) const;
+    };
+
+private:
+    static const size_t MEMORY_BYTES = 256 * 1024 * 1024;
+    static const off_t DISK_BYTES = 1024 * 1024 * 1024;
+    static const time_t DISK_MAX_AGE = 30 * 24 * 60 * 60;
+
+    struct Entry
+    {
+        FileStamp stamp;
+        Report report;
+        size_t bytes;
+        std::list<std::string>::iterator recent;
+
+        Entry() : stamp(), report(), bytes(0), recent() {}
+    };
+
+    std::string directory;
+    std::mutex mutex;
+    std::map<std::string, Entry> entries;
+    std::list<std::string> recentPaths;
+    size_t memoryBytes;
+
+    std::string diskPath(const std::string &path);
+    Report loadFromDisk(const std::string &path, const FileStamp &stamp);
+    void saveToDisk(const std::string &path, const FileStamp &stamp, const names_and_events &report);
+    void pruneDisk();
+    void remember(const std::string &path, const FileStamp &stamp, const Report &report);
+    void forget(std::map<std::string, Entry>::iterator it);
+
+public:
+    // directory for the on-disk copies, created if need be; an empty string, or a directory that
+    // is not private to the user, keeps the cache in memory only
+    explicit ReportCache(const std::string &directory);
+
+    // $STOMP_REPORT_CACHE if set, otherwise the reports directory of the user's cache
+    static std::string defaultDirectory();
+
+    // Fills stamp with the file's current one, false if the file cannot be stat'ed
+    static bool statFile(const std::string &path, FileStamp &stamp);
+
+    // The report cached for path under stamp, or null if there is none
+    Report lookup(const std::string &path, const FileStamp &stamp);
+    // Caches report as the contents of path when it had stamp, the stamp taken before parsing it
+    void store(const std::string &path, const FileStamp &stamp, const Report &report);
+};
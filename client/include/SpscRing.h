@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+// Lock-free ring for exactly one producer thread and one consumer thread. The producer owns
+// tail, the consumer owns head, and each publishes its index with release so the other side
+// sees the slot contents. Neither side takes a lock while items flow. A full ring is waited out
+// with a spin-then-sleep backoff; the consumer of an empty ring spins briefly, then parks on a
+// condition variable, and the producer takes the lock to wake it only while it is parked. Once
+// closed, push() refuses new items and popBatch() drains what is left before returning 0.
+template <typename T>
+class SpscRing
+{
+private:
+    static const size_t CACHE_LINE = 64;
+    static const unsigned SPIN_ROUNDS = 64;
+
+    std::vector<T> slots;
+    size_t mask;
+
+    alignas(CACHE_LINE) std::atomic<size_t> head; // next slot to read, written by the consumer
+    alignas(CACHE_LINE) std::atomic<size_t> tail; // next slot to write, written by the producer
+    alignas(CACHE_LINE) std::atomic<bool> closed;
+
+    // set while the consumer waits on wakeup, which parkMutex guards
+    std::atomic<bool> parked;
+    std::mutex parkMutex;
+    std::condition_variable wakeup;
+
+    // occupancy metrics, each written by one side only
+    std::atomic<size_t> pushed;
+    std::atomic<size_t> peak;
+    std::atomic<size_t> fullWaits;
+    std::atomic<size_t> batches;
+
+    static size_t roundUp(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        return size;
+    }
+
+    static void backoff(unsigned &round)
+    {
+        if (round < SPIN_ROUNDS)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        round++;
+    }
+
+    // Consumer side. Sleeps until the producer publishes past h or the ring is closed. parked is
+    // set before tail is read again and the producer reads parked after publishing, the fences
+    // between ensure at least one of the two sees the other's write
+    void park(size_t h)
+    {
+        std::unique_lock<std::mutex> lock(parkMutex);
+        parked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wakeup.wait(lock, [&]() {
+            return tail.load(std::memory_order_acquire) != h || closed.load(std::memory_order_acquire);
+        });
+        parked.store(false, std::memory_order_relaxed);
+    }
+
+    // Wakes a parked consumer after tail or closed was written
+    void wake()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!parked.load(std::memory_order_relaxed))
+            return;
+        std::lock_guard<std::mutex> lock(parkMutex);
+        wakeup.notify_one();
+    }
+
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscRing(size_t capacity)
+        : slots(roundUp(capacity)), mask(roundUp(capacity) - 1), head(0), tail(0), closed(false),
+          parked(false), parkMutex(), wakeup(), pushed(0), peak(0), fullWaits(0), batches(0) {}
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    // Producer side. Waits while the ring is full, returns false if it was closed
+    bool push(T item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        unsigned round = 0;
+        while (t - head.load(std::memory_order_acquire) == slots.size())
+        {
+            if (closed.load(std::memory_order_acquire))
+                return false;
+            if (round == 0)
+                fullWaits.fetch_add(1, std::memory_order_relaxed);
+            backoff(round);
+        }
+        if (closed.load(std::memory_order_acquire))
+            return false;
+
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        wake();
+
+        pushed.fetch_add(1, std::memory_order_relaxed);
+        size_t occupancy = t + 1 - head.load(std::memory_order_relaxed);
+        if (occupancy > peak.load(std::memory_order_relaxed))
+            peak.store(occupancy, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer side. Waits until at least one item is available, then moves up to max items
+    // into out. Returns the number taken, 0 once the ring is closed and drained
+    size_t popBatch(std::vector<T> &out, size_t max)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        unsigned round = 0;
+        while (t == h)
+        {
+            if (closed.load(std::memory_order_acquire))
+            {
+                // the producer may have published a last item before closing
+                t = tail.load(std::memory_order_acquire);
+                if (t == h)
+                    return 0;
+                break;
+            }
+            if (round < SPIN_ROUNDS)
+            {
+                std::this_thread::yield();
+                round++;
+            }
+            else
+                park(h);
+            t = tail.load(std::memory_order_acquire);
+        }
+
+        size_t count = t - h < max ? t - h : max;
+        for (size_t i = 0; i < count; i++)
+            out.push_back(std::move(slots[(h + i) & mask]));
+        head.store(h + count, std::memory_order_release);
+        batches.fetch_add(1, std::memory_order_relaxed);
+        return count;
+    }
+
+    // Either side may close; the producer closes when its input ends, the consumer when it stops early
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+        wake();
+    }
+
+    size_t capacity() const { return slots.size(); }
+    size_t pushedCount() const { return pushed.load(std::memory_order_relaxed); }
+    size_t peakOccupancy() const { return peak.load(std::memory_order_relaxed); }
+    size_t fullWaitCount() const { return fullWaits.load(std::memory_order_relaxed); }
+    size_t batchCount() const { return batches.load(std::memory_order_relaxed); }
+};
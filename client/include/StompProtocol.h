@@ -2,10 +2,23 @@
 
 #include "../include/ConnectionHandler.h"
 #include "../include/event.h"
+#include "../include/ReportCache.h"
+#include "../include/BoundedQueue.h"
+#include "../include/ReceiptRing.h"
+#include "../include/EventLog.h"
+#include "../include/EventIndex.h"
+#include "../include/SummaryEncoder.h"
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <memory>
+#include <unordered_set>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
 #include <sstream>
 #include <fstream>
 #include <iostream>
@@ -17,58 +30,265 @@ using std::endl;
 using std::string;
 using std::vector;
 using std::map;
+using std::unordered_map;
 using std::stringstream;
 using std::to_string;
 
 class StompProtocol {
 private:
     string username;
-    int subIdCounter;
-    int receiptIdCounter;
-    bool shouldTerminate;
+    std::atomic<int> subIdCounter;
+    std::atomic<int> receiptIdCounter;
+    // set once the session ends, receiptArrived is notified whenever it is set
+    std::atomic<bool> shouldTerminate;
+
+    // Guards the session state: subscriptions, pending receipts and report windows.
+    // Stored game data is sharded per game, see GameShard.
     std::mutex mutex;
 
     // (gameName, subscriptionID) map
-    map<string, int> subscriptions;
+    unordered_map<string, int> subscriptions;
+
+    // (receiptID, action description) ring
+    ReceiptRing<string> pendingReceipts;
+
+    // (receiptID, gameName) map of the exits awaiting their UNSUBSCRIBE receipt. A game's data is
+    // released once the receipt arrives, after every MESSAGE the broker sent for it before
+    unordered_map<int, string> exitReceipts;
+
+    // one user's stats and events in a game together with their summary rendered in each format
+    // asked for so far, the team names (kept even if every event is evicted), the bytes its events
+    // occupy and how many were evicted
+    struct UserGame {
+        GameStats stats;
+        unordered_map<string, RenderedSummary> rendered;
+        string teamA;
+        string teamB;
+        size_t eventBytes;
+        size_t evicted;
 
-    // (receiptID, action description) map
-    map<int, string> pendingReceipts;
+        explicit UserGame(GameArena* arena)
+            : stats(ArenaAllocator<Event>(arena)), rendered(), teamA("Team A"), teamB("Team B"), eventBytes(0), evicted(0) {}
+    };
+
+    // one game's (username, userGame) map with its own lock, so ingesting or summarizing
+    // one game never waits on another; the game's name, the arena its users' events live in, the
+    // index over them, totals over its users and the tick it was last used. The arena is declared
+    // before the events so it outlives those allocated from it. A shard handed out by findGame may
+    // be released before its lock is taken; released is set under the lock, and a released shard
+    // takes no more events and counts nothing towards storedBytes.
+    struct GameShard {
+        const string name;
+        std::mutex mutex;
+        std::unique_ptr<GameArena> arena;
+        unordered_map<string, UserGame> users;
+        EventIndex index;
+        size_t events;
+        size_t bytes;
+        std::atomic<unsigned long long> lastUsed;
+        bool released;
+
+        explicit GameShard(const string& name)
+            : name(name), mutex(), arena(new GameArena()), users(), index(arena.get()), events(0), bytes(0), lastUsed(0),
+              released(false) {}
+        // the events and the index hold nothing but arena memory, so they are left to the arena
+        // rather than destroyed one by one: releasing a game costs unmapping its chunks
+        ~GameShard() {
+            for (auto& pair : users)
+                arena->abandon(pair.second.stats.events);
+            index.abandon();
+        }
+    };
 
-    // (gameName, (username, gameStats)) map
-    struct GameStats {
-        map<string, string> generalStats;
-        map<string, string> teamAStats;
-        map<string, string> teamBStats;
-        vector<Event> events;
+    // (gameName, game shard) map, gamesMutex guards the index only
+    std::mutex gamesMutex;
+    unordered_map<string, std::shared_ptr<GameShard>> gameUpdates;
+
+    // Retention limits for stored events, 0 means unlimited. The per-game limits cover all users'
+    // events of a game, age is in game seconds behind the game's newest event. Past the total,
+    // the least recently used games lose their oldest events first. Evicted events are dropped,
+    // the accumulated stats are kept.
+    struct RetentionPolicy {
+        std::atomic<size_t> gameEvents;
+        std::atomic<size_t> gameBytes;
+        std::atomic<int> maxAge;
+        std::atomic<size_t> totalBytes;
+
+        RetentionPolicy() : gameEvents(0), gameBytes(0), maxAge(0), totalBytes(0) {}
+    };
+    RetentionPolicy retention;
+    // evicted events stay in their game's arena until more than half of an arena of at least
+    // this size is dead, then the game's events move to a fresh one
+    static const size_t ARENA_COMPACT_BYTES = 4 * 1024 * 1024;
+    // bytes of all stored events and the clock behind GameShard::lastUsed
+    std::atomic<size_t> storedBytes;
+    std::atomic<unsigned long long> useClock;
+
+    // ("username/gameName", content hashes of the events the broker confirmed there) map, for the
+    // current session; a game's entry goes when the game is released
+    std::mutex publishedMutex;
+    unordered_map<string, std::unordered_set<size_t>> publishedEvents;
+
+    // A report window awaiting its receipt: the frames it confirms and, per publishedEvents key,
+    // the content hashes they carried. The hashes count as published once the receipt arrives.
+    struct ReportWindow {
+        size_t frames;
+        unordered_map<string, vector<size_t>> hashes;
+
+        ReportWindow() : frames(0), hashes() {}
+    };
+
+    // (receiptID, report window) ring of the windows awaiting a receipt,
+    // the frames confirmed so far in the current report and the signal for new receipts
+    ReceiptRing<ReportWindow> reportWindows;
+    size_t acknowledgedFrames;
+    std::condition_variable receiptArrived;
+
+    // parsed and sorted report files, reused while the file is unchanged
+    ReportCache reportCache;
+
+    // The logged in user's log of received events, evictions and released games, replayed into
+    // gameUpdates at login. Replaced only at login, when no session threads run; null before the
+    // first one. While replaying, retention is held off and evictions are not logged again.
+    // A log with more than LOG_COMPACT_SEGMENTS segments, or at least LOG_COMPACT_MIN_RECORDS
+    // records and twice as many as the data it replays into, is rewritten as a checkpoint.
+    static const size_t LOG_COMPACT_SEGMENTS = 8;
+    static const size_t LOG_COMPACT_MIN_RECORDS = 4096;
+    std::unique_ptr<EventLog> eventLog;
+    bool replaying;
+
+    // Summaries are written by a pool of background writers so the keyboard thread only takes
+    // the snapshot; the bounded queue holds the submitted jobs, each with its output format and
+    // its turn at the file
+    static const size_t SUMMARY_QUEUE_CAPACITY = 64;
+    static const size_t SUMMARY_WRITERS = 2;
+    static const size_t SUMMARY_BUFFER_BYTES = 1024 * 1024;
+    struct SummaryJob {
+        string file;
+        std::unique_ptr<SummaryEncoder> encoder;
+        SummaryData data;
+        std::chrono::steady_clock::time_point submitted;
+        unsigned long long turn;
+
+        SummaryJob() : file(), encoder(), data(), submitted(), turn(0) {}
+    };
+    BoundedQueue<SummaryJob> summaryJobs;
+    vector<std::thread> summaryWriters;
+
+    // Summaries of one file are written one at a time in the order they were submitted, since
+    // each truncates the file: (file, turns) map of the files with a summary queued or being written
+    struct FileTurns {
+        unsigned long long next;     // turn of the next summary submitted
+        unsigned long long serving;  // turn allowed to write now
+
+        FileTurns() : next(0), serving(0) {}
+    };
+    std::mutex summaryFilesMutex;
+    std::condition_variable summaryFileDone;
+    unordered_map<string, FileTurns> summaryFiles;
+
+    // Report pipeline: per-file load state, the frames passed from the serializer to the
+    // sender (an empty frame marks a file that failed to load), per-stage busy time and counters
+    enum LoadState { LOAD_PENDING, LOAD_DONE, LOAD_FAILED };
+    static const size_t REPORT_QUEUE_CAPACITY = 256;
+    static const size_t REPORT_MAX_WINDOWS = 8;
+    static const std::chrono::seconds REPORT_ACK_TIMEOUT;
+    static const size_t STREAM_WINDOW_EVENTS = 16384;
+    static const size_t STREAM_CHUNK_EVENTS = 256;
+    struct ReportOptions {
+        size_t batchSize;   // events per SEND frame
+        double pace;        // game clock speed multiplier, 0 sends as fast as possible
+        bool full;          // resend events that were already published
+        bool stream;        // decode, order and send files in bounded memory
+        size_t ackEvery;    // frames per receipt window, 0 asks for a receipt on the last frame only
+
+        ReportOptions() : batchSize(1), pace(0), full(false), stream(false), ackEvery(0) {}
+    };
+    struct ReportFrame {
+        string file;
+        string frame;
+        int gameTime;       // time of the frame's first event
+        bool firstOfFile;
+        string publishKey;  // key into publishedEvents
+        vector<size_t> eventHashes;
+
+        ReportFrame() : file(), frame(), gameTime(0), firstOfFile(false), publishKey(), eventHashes() {}
+        ReportFrame(const string& file, const string& frame, int gameTime = 0, bool firstOfFile = false)
+            : file(file), frame(frame), gameTime(gameTime), firstOfFile(firstOfFile), publishKey(), eventHashes() {}
+    };
+    struct ReportStats {
+        std::atomic<long long> parse;
+        std::atomic<long long> sort;
+        std::atomic<long long> serialize;
+        std::atomic<long long> send;
+        std::atomic<size_t> skipped;
 
-        GameStats() : generalStats(), teamAStats(), teamBStats(), events() {}
+        ReportStats() : parse(0), sort(0), serialize(0), send(0), skipped(0) {}
     };
-    map<string, map<string, GameStats>> gameUpdates; 
 
     // Keyboard Command Handlers
     void handleJoin(const string& gameName, ConnectionHandler* handler);
     void handleExit(const string& gameName, ConnectionHandler* handler);
     void handleLogout(ConnectionHandler* handler);
-    void handleReport(const string& file, ConnectionHandler* handler);
-    void handleSummary(const string& gameName, const string& user, const string& file);
+    void handleReport(const vector<string>& patterns, const ReportOptions& options, ConnectionHandler* handler);
+    void handleSummary(const string& gameName, const string& user, const string& file, const string& format);
+    void handlePurge(const string& gameName);
+    void handleRetention();
+    void handleQuery(const string& gameName, int from, int to, const string& name, const string& user);
 
     // Server Frame Handlers
     void handleServerConnected(const vector<string>& lines);
     void handleServerReceipt(const vector<string>& lines);
     void handleServerError(const vector<string>& lines);
-    void handleServerMessage(const vector<string>& lines);
+    void handleServerMessage(const string& frame);
 
     // Helper Methods
     void sendFrame(ConnectionHandler* handler, string body);
+    bool loadReport(const string& file, ReportCache::Report& report, ReportStats& stats);
+    bool serializeReport(const string& file, const names_and_events& data, const ReportOptions& options,
+                         BoundedQueue<ReportFrame>& frames, ReportStats& stats, bool& firstSend);
+    bool serializeStream(const string& file, const ReportOptions& options,
+                         BoundedQueue<ReportFrame>& frames, ReportStats& stats);
+    void dropReportWindows();
+    static long long elapsedNanos(std::chrono::steady_clock::time_point since);
+    static void waitUntil(std::chrono::steady_clock::time_point deadline);
+    vector<string> expandPaths(const vector<string>& patterns);
+    void recoverEvents();
+    void replayEviction(const string& gameName, const string& user, size_t count);
+    void replayStats(const string& gameName, const string& user, const string& teamA, const string& teamB,
+                     size_t evicted, GameStats& stats);
+    void checkpointEventLog();
     void saveEvent(string gameName, string user, Event& event);
+    void storeEvent(const string& gameName, const string& user, Event& event);
+    static void mergeStats(map<string, string>& stats, const EventUpdates& updates);
+    void takeSummary(UserGame& userGame, const string& format, const SummaryEncoder& encoder, SummaryData& data);
+    void writeSummaries();
+    void writeSummary(const SummaryJob& job);
+    void finishSummaryTurn(const string& file);
+    string saveEventBody(const string& gameName, const string& frame, size_t offset, size_t length);
+    std::shared_ptr<GameShard> findGame(const string& gameName, bool create);
+    vector<std::pair<string, std::shared_ptr<GameShard>>> enforceRetention();
+    void enforceGameRetention(GameShard& game);
+    void enforceTotalRetention();
+    void evictOldest(GameShard& game, size_t maxEvents, size_t maxBytes, int minTime);
+    void evictFront(GameShard& game, const string& user, UserGame& userGame, size_t count);
+    void compactArena(GameShard& game);
+    bool releaseGame(const string& gameName);
+    bool dropGame(const string& gameName);
+    void dropAllGames();
     string buildEventBody(const Event& event, string user, string gameName);
     string trim(const string& str);
     vector<string> split(const string& str, char delimiter);
 
 public:
     StompProtocol();
+    // finishes the summaries still queued
+    ~StompProtocol();
 
+    // starts the session of a new login
     void setUsername(string username);
+    // ends the session once its connection is gone
+    void endSession();
     void processKeyboardCommand(const string& commandLine, ConnectionHandler* handler);
     bool processServerFrame(const string& frame);
-};
\ No newline at end of file
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "../include/event.h"
+#include "../include/EventCodec.h"
+#include <string>
+#include <vector>
+#include <memory>
+
+// The cached rendering of one (game, user) summary in one format: the head, everything in front
+// of the events, and the events' part, eventOffsets[i] being where event i starts in eventsText.
+// Only the events inserted since the last render are rendered again, and the head whenever the
+// stats, the events or the eviction count changed. The texts are shared with summaries being
+// written, so they are replaced rather than modified while shared. keys is the key table the
+// binary format encodes the events with.
+struct RenderedSummary
+{
+    bool headDirty;
+    size_t eventsDirtyFrom;
+    std::shared_ptr<const std::string> headText;
+    std::shared_ptr<std::string> eventsText;
+    std::vector<size_t> eventOffsets;
+    EventKeyTable keys;
+
+    RenderedSummary()
+        : headDirty(true), eventsDirtyFrom(0), headText(std::make_shared<const std::string>()),
+          eventsText(std::make_shared<std::string>()), eventOffsets(), keys() {}
+};
+
+// Everything an encoder needs to write one (game, user) summary, taken under the game's lock
+// and read without it: who and what it is of and its rendered parts, shared with the cache
+struct SummaryData
+{
+    std::string gameName;
+    std::string user;
+    std::string teamA;
+    std::string teamB;
+    size_t evicted;
+    std::shared_ptr<const std::string> headText;
+    std::shared_ptr<const std::string> eventsText;
+
+    SummaryData() : gameName(), user(), teamA(), teamB(), evicted(0), headText(), eventsText() {}
+};
+
+// Output file with one preallocated buffer: appends copy into it and every flush is a single
+// write() of the whole buffer. Failures are remembered and reported by close().
+class SummaryBuffer
+{
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t used;
+    size_t written;
+    bool failed;
+
+    void writeOut(const char *data, size_t size);
+
+public:
+    SummaryBuffer(const std::string &path, size_t capacity);
+    ~SummaryBuffer();
+
+    SummaryBuffer(const SummaryBuffer &) = delete;
+    SummaryBuffer &operator=(const SummaryBuffer &) = delete;
+
+    bool isOpen() const;
+    void append(const char *data, size_t size);
+    void append(const std::string &text);
+    void flush();
+    // flushes and closes, false if any write failed
+    bool close();
+    // bytes written so far, flushed or not
+    size_t size() const;
+};
+
+// One summary output format, rendered ahead into a RenderedSummary and written from it
+class SummaryEncoder
+{
+public:
+    virtual ~SummaryEncoder();
+
+    // Brings rendered up to date with stats and fills in data's parts from it; data's other
+    // fields must be set. Must hold the game's lock.
+    void render(const GameStats &stats, RenderedSummary &rendered, SummaryData &data) const;
+    void encode(const SummaryData &data, SummaryBuffer &out) const;
+
+protected:
+    // append the part in front of the events and the part of one event
+    virtual void renderHead(const SummaryData &data, const GameStats &stats, EventKeyTable &keys,
+                            std::string &text) const = 0;
+    virtual void renderEvent(const SummaryData &data, const Event &event, EventKeyTable &keys,
+                             std::string &text) const = 0;
+};
+
+// Encoder for "text" (the layout summary has always written), "jsonl", "csv" or "binary",
+// nullptr for any other name
+std::unique_ptr<SummaryEncoder> makeSummaryEncoder(const std::string &format);
@@ -1,44 +1,70 @@
 #pragma once
 
+#include "../include/GameArena.h"
 #include <string>
 #include <iostream>
 #include <map>
 #include <vector>
+#include <deque>
+#include <cstdint>
+#include <functional>
+
+// Strings and update maps of an Event allocate through its allocator: from the game's arena for
+// events in a game's storage, from the heap for all others
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> EventString;
+typedef std::map<EventString, EventString, std::less<EventString>, ArenaAllocator<std::pair<const EventString, EventString>>> EventUpdates;
 
 class Event
 {
 private:
     // name of team a
-    std::string team_a_name;
+    EventString team_a_name;
     // name of team b
-    std::string team_b_name;
+    EventString team_b_name;
     // name of the event
-    std::string name;
+    EventString name;
     // time of the event in seconds
     int time;
     // map of all the general game updates
-    std::map<std::string, std::string> game_updates;
+    EventUpdates game_updates;
     // map of all team a updates the second type can be a string bool or int
-    std::map<std::string, std::string> team_a_updates;
+    EventUpdates team_a_updates;
     // map of all team b updates
-    std::map<std::string, std::string> team_b_updates;
+    EventUpdates team_b_updates;
     // description of the event
-    std::string description;
+    EventString description;
+    // packed ordering key: period (4 bits) | time + 2^27 (28 bits) | arrival sequence (32 bits)
+    uint64_t sort_key;
+
+    void compute_sort_key();
 
 public:
-    Event(std::string name, std::string team_a_name, std::string team_b_name, int time, std::map<std::string, std::string> game_updates, std::map<std::string, std::string> team_a_updates, std::map<std::string, std::string> team_b_updates, std::string discription);
-    Event(const std::string & frame_body);
+    Event(EventString name, EventString team_a_name, EventString team_b_name, int time, EventUpdates game_updates, EventUpdates team_a_updates, EventUpdates team_b_updates, EventString discription);
+    Event(const std::string & frame_body, size_t offset = 0, size_t length = std::string::npos);
+    // copies other into storage allocated through allocator, keeping its sort key
+    Event(const Event &other, const ArenaAllocator<char> &allocator);
+    Event(const Event &) = default;
+    Event(Event &&) = default;
+    Event &operator=(const Event &) = default;
+    Event &operator=(Event &&) = default;
     virtual ~Event();
-    const std::string &get_team_a_name() const;
-    const std::string &get_team_b_name() const;
-    const std::string &get_name() const;
+    const EventString &get_team_a_name() const;
+    const EventString &get_team_b_name() const;
+    const EventString &get_name() const;
     int get_time() const;
-    const std::map<std::string, std::string> &get_game_updates() const;
-    const std::map<std::string, std::string> &get_team_a_updates() const;
-    const std::map<std::string, std::string> &get_team_b_updates() const;
-    const std::string &get_description() const;
+    const EventUpdates &get_game_updates() const;
+    const EventUpdates &get_team_a_updates() const;
+    const EventUpdates &get_team_b_updates() const;
+    const EventString &get_description() const;
+    uint64_t get_sort_key() const;
+    // approximate bytes the event occupies, its strings and map nodes included
+    size_t memory_usage() const;
 };
 
+// an EventString with the contents of a std::string, and the other way round
+inline EventString to_event_string(const std::string &str) { return EventString(str.data(), str.size()); }
+inline std::string to_std_string(const EventString &str) { return std::string(str.data(), str.size()); }
+
 // an object that holds the names of the teams and a vector of events, to be returned by the parseEventsFile function
 struct names_and_events {
     std::string team_a_name;
@@ -50,5 +76,30 @@ struct names_and_events {
         : team_a_name(team_a), team_b_name(team_b), events(events_list) {}
 };
 
+typedef std::deque<Event, ArenaAllocator<Event>> EventList;
+
+// the accumulated stats and received events of one game as reported by one user
+struct GameStats {
+    std::map<std::string, std::string> generalStats;
+    std::map<std::string, std::string> teamAStats;
+    std::map<std::string, std::string> teamBStats;
+    // kept ordered by sort key; a deque so retention can drop the oldest events cheaply
+    EventList events;
+
+    GameStats() : generalStats(), teamAStats(), teamBStats(), events() {}
+    // events allocated through allocator, which the events added must share
+    explicit GameStats(const ArenaAllocator<Event> &allocator)
+        : generalStats(), teamAStats(), teamBStats(), events(allocator) {}
+
+    // inserts keeping events ordered: in-order arrivals are appended, stragglers are placed by binary search;
+    // returns the index the event landed at
+    size_t addEvent(Event event);
+};
+
 // function that parses the json file and returns a names_and_events object
 names_and_events parseEventsFile(std::string json_path);
+
+// function that memory-maps the json file and hands every event to on_event as soon as it is parsed,
+// without keeping them; returns the team names. Events that precede the team names in the file
+// are handed over with empty team names.
+names_and_events streamEventsFile(const std::string &json_path, const std::function<void(Event &)> &on_event);
@@ -1,4 +1,5 @@
 #include "../include/ConnectionHandler.h"
+#include <sys/socket.h>
 
 using boost::asio::ip::tcp;
 
@@ -9,7 +10,7 @@ using std::endl;
 using std::string;
 
 ConnectionHandler::ConnectionHandler(string host, short port) : host_(host), port_(port), io_service_(),
-                                                                socket_(io_service_) {}
+                                                                socket_(io_service_), closing_(false) {}
 
 ConnectionHandler::~ConnectionHandler() {
 	close();
@@ -42,7 +43,8 @@ bool ConnectionHandler::getBytes(char bytes[], unsigned int bytesToRead) {
 		if (error)
 			throw boost::system::system_error(error);
 	} catch (std::exception &e) {
-		std::cerr << "recv failed (Error: " << e.what() << ')' << std::endl;
+		if (!closing_)
+			std::cerr << "recv failed (Error: " << e.what() << ')' << std::endl;
 		return false;
 	}
 	return true;
@@ -58,7 +60,8 @@ bool ConnectionHandler::sendBytes(const char bytes[], int bytesToWrite) {
 		if (error)
 			throw boost::system::system_error(error);
 	} catch (std::exception &e) {
-		std::cerr << "recv failed (Error: " << e.what() << ')' << std::endl;
+		if (!closing_)
+			std::cerr << "recv failed (Error: " << e.what() << ')' << std::endl;
 		return false;
 	}
 	return true;
@@ -106,3 +109,14 @@ void ConnectionHandler::close() {
 		std::cout << "closing failed: connection already closed" << std::endl;
 	}
 }
+
+void ConnectionHandler::expectClose() {
+	closing_ = true;
+}
+
+// Shuts the socket down without closing it, so a read in progress on another thread wakes up
+// with end of file while the descriptor it uses stays valid
+void ConnectionHandler::shutdown() {
+	closing_ = true;
+	::shutdown(socket_.native_handle(), SHUT_RDWR);
+}
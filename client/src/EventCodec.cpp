@@ -0,0 +1,303 @@
+#include "../include/EventCodec.h"
+#include <map>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+
+namespace
+{
+    const char MAGIC[4] = {'S', 'E', 'V', 'B'};
+    const unsigned char KIND_EVENT = 1;
+    const unsigned char KIND_GAME_STATS = 2;
+    const unsigned char KIND_REPORT = 3;
+    const unsigned char KIND_SUMMARY = 4;
+
+    void putVarint(std::string &out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back((char)((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back((char)value);
+    }
+
+    template <typename String>
+    void putString(std::string &out, const String &str)
+    {
+        putVarint(out, str.size());
+        out.append(str.data(), str.size());
+    }
+
+    // stats maps and event update maps, interning their keys into keys
+    template <typename Map>
+    void putMap(std::string &out, EventKeyTable &keys, const Map &updates)
+    {
+        putVarint(out, updates.size());
+        for (auto &pair : updates)
+        {
+            putVarint(out, keys.intern(pair.first.data(), pair.first.size()));
+            putString(out, pair.second);
+        }
+    }
+
+    void putStats(std::string &out, EventKeyTable &keys, const GameStats &stats)
+    {
+        putMap(out, keys, stats.generalStats);
+        putMap(out, keys, stats.teamAStats);
+        putMap(out, keys, stats.teamBStats);
+    }
+
+    void putEvent(std::string &out, EventKeyTable &keys, const Event &event)
+    {
+        putString(out, event.get_team_a_name());
+        putString(out, event.get_team_b_name());
+        putString(out, event.get_name());
+        int64_t time = event.get_time();
+        putVarint(out, ((uint64_t)time << 1) ^ (uint64_t)(time >> 63));
+        putMap(out, keys, event.get_game_updates());
+        putMap(out, keys, event.get_team_a_updates());
+        putMap(out, keys, event.get_team_b_updates());
+        putString(out, event.get_description());
+    }
+
+    // The record: the header and the key table in front of the payload, which is written first
+    // so every key it uses is interned by then
+    std::string finish(unsigned char kind, const EventKeyTable &keys, const std::string &payload)
+    {
+        std::string out(MAGIC, sizeof(MAGIC));
+        out.push_back((char)EVENT_CODEC_VERSION);
+        out.push_back((char)kind);
+        keys.put(out);
+        out.append(payload);
+        return out;
+    }
+
+    class Reader
+    {
+    private:
+        const std::string &buffer;
+        size_t pos;
+        std::vector<std::string> keys;
+
+    public:
+        Reader(const std::string &buffer, unsigned char kind) : buffer(buffer), pos(0), keys()
+        {
+            if (buffer.size() < sizeof(MAGIC) + 2 || buffer.compare(0, sizeof(MAGIC), MAGIC, sizeof(MAGIC)) != 0)
+                throw std::runtime_error("event codec: bad magic");
+            pos = sizeof(MAGIC);
+            if ((unsigned char)buffer[pos++] != EVENT_CODEC_VERSION)
+                throw std::runtime_error("event codec: unsupported version");
+            if ((unsigned char)buffer[pos++] != kind)
+                throw std::runtime_error("event codec: unexpected record kind");
+
+            uint64_t count = getVarint();
+            if (count > buffer.size() - pos)
+                throw std::runtime_error("event codec: truncated key table");
+            keys.reserve(count);
+            for (uint64_t i = 0; i < count; i++)
+                keys.push_back(getString());
+        }
+
+        uint64_t getVarint()
+        {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (pos >= buffer.size())
+                    throw std::runtime_error("event codec: truncated varint");
+                unsigned char byte = buffer[pos++];
+                value |= (uint64_t)(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                    return value;
+            }
+            throw std::runtime_error("event codec: varint too long");
+        }
+
+        template <typename String = std::string>
+        String getString()
+        {
+            uint64_t length = getVarint();
+            if (length > buffer.size() - pos)
+                throw std::runtime_error("event codec: truncated string");
+            String str(buffer.data() + pos, length);
+            pos += length;
+            return str;
+        }
+
+        template <typename Map>
+        Map getMap()
+        {
+            typedef typename Map::key_type String;
+            Map updates;
+            uint64_t count = getVarint();
+            for (uint64_t i = 0; i < count; i++)
+            {
+                uint64_t index = getVarint();
+                if (index >= keys.size())
+                    throw std::runtime_error("event codec: key index out of range");
+                String value = getString<String>();
+                updates.insert(updates.end(), std::make_pair(String(keys[index].data(), keys[index].size()), std::move(value)));
+            }
+            return updates;
+        }
+
+        Event getEvent()
+        {
+            EventString team_a_name = getString<EventString>();
+            EventString team_b_name = getString<EventString>();
+            EventString name = getString<EventString>();
+            uint64_t zigzag = getVarint();
+            int time = (int)(int64_t)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+            EventUpdates game_updates = getMap<EventUpdates>();
+            EventUpdates team_a_updates = getMap<EventUpdates>();
+            EventUpdates team_b_updates = getMap<EventUpdates>();
+            EventString description = getString<EventString>();
+            return Event(std::move(team_a_name), std::move(team_b_name), std::move(name), time, std::move(game_updates),
+                         std::move(team_a_updates), std::move(team_b_updates), std::move(description));
+        }
+
+        void getStats(GameStats &stats)
+        {
+            stats.generalStats = getMap<std::map<std::string, std::string>>();
+            stats.teamAStats = getMap<std::map<std::string, std::string>>();
+            stats.teamBStats = getMap<std::map<std::string, std::string>>();
+            uint64_t count = getVarint();
+            for (uint64_t i = 0; i < count; i++)
+                stats.events.push_back(getEvent());
+        }
+
+        void expectEnd()
+        {
+            if (pos != buffer.size())
+                throw std::runtime_error("event codec: trailing bytes");
+        }
+    };
+}
+
+EventKeyTable::EventKeyTable() : index(), keys() {}
+
+uint64_t EventKeyTable::intern(const char *data, size_t size)
+{
+    std::string key(data, size);
+    auto found = index.find(key);
+    if (found == index.end())
+    {
+        found = index.insert(std::make_pair(key, (uint64_t)keys.size())).first;
+        keys.push_back(&found->first);
+    }
+    return found->second;
+}
+
+void EventKeyTable::put(std::string &out) const
+{
+    putVarint(out, keys.size());
+    for (const std::string *key : keys)
+        putString(out, *key);
+}
+
+std::string encodeEvent(const Event &event)
+{
+    EventKeyTable keys;
+    std::string payload;
+    putEvent(payload, keys, event);
+    return finish(KIND_EVENT, keys, payload);
+}
+
+Event decodeEvent(const std::string &buffer)
+{
+    Reader reader(buffer, KIND_EVENT);
+    Event event = reader.getEvent();
+    reader.expectEnd();
+    return event;
+}
+
+std::string encodeGameStats(const GameStats &stats)
+{
+    EventKeyTable keys;
+    std::string payload;
+    putStats(payload, keys, stats);
+    putVarint(payload, stats.events.size());
+    for (const Event &event : stats.events)
+        putEvent(payload, keys, event);
+    return finish(KIND_GAME_STATS, keys, payload);
+}
+
+GameStats decodeGameStats(const std::string &buffer)
+{
+    Reader reader(buffer, KIND_GAME_STATS);
+    GameStats stats;
+    reader.getStats(stats);
+    reader.expectEnd();
+    return stats;
+}
+
+std::string encodeReport(const names_and_events &report)
+{
+    EventKeyTable keys;
+    std::string payload;
+    putString(payload, report.team_a_name);
+    putString(payload, report.team_b_name);
+    putVarint(payload, report.events.size());
+    for (const Event &event : report.events)
+        putEvent(payload, keys, event);
+    return finish(KIND_REPORT, keys, payload);
+}
+
+names_and_events decodeReport(const std::string &buffer)
+{
+    Reader reader(buffer, KIND_REPORT);
+    names_and_events report;
+    report.team_a_name = reader.getString();
+    report.team_b_name = reader.getString();
+    uint64_t count = reader.getVarint();
+    for (uint64_t i = 0; i < count; i++)
+        report.events.push_back(reader.getEvent());
+    reader.expectEnd();
+    return report;
+}
+
+std::string encodeSummary(const SummaryRecord &summary)
+{
+    EventKeyTable keys;
+    std::string events;
+    for (const Event &event : summary.stats.events)
+        encodeSummaryEvent(keys, event, events);
+    return encodeSummaryHead(keys, summary.gameName, summary.user, summary.teamA, summary.teamB, summary.evicted,
+                             summary.stats) +
+           events;
+}
+
+SummaryRecord decodeSummary(const std::string &buffer)
+{
+    Reader reader(buffer, KIND_SUMMARY);
+    SummaryRecord summary;
+    summary.gameName = reader.getString();
+    summary.user = reader.getString();
+    summary.teamA = reader.getString();
+    summary.teamB = reader.getString();
+    summary.evicted = reader.getVarint();
+    reader.getStats(summary.stats);
+    reader.expectEnd();
+    return summary;
+}
+
+void encodeSummaryEvent(EventKeyTable &keys, const Event &event, std::string &out)
+{
+    putEvent(out, keys, event);
+}
+
+std::string encodeSummaryHead(EventKeyTable &keys, const std::string &gameName, const std::string &user,
+                              const std::string &teamA, const std::string &teamB, uint64_t evicted,
+                              const GameStats &stats)
+{
+    std::string payload;
+    putString(payload, gameName);
+    putString(payload, user);
+    putString(payload, teamA);
+    putString(payload, teamB);
+    putVarint(payload, evicted);
+    putStats(payload, keys, stats);
+    putVarint(payload, stats.events.size());
+    return finish(KIND_SUMMARY, keys, payload);
+}
@@ -0,0 +1,147 @@
+#include "../include/EventIndex.h"
+#include <algorithm>
+#include <cctype>
+
+EventIndex::EventIndex(GameArena *arena)
+    : arena(arena), byTime(ArenaAllocator<std::pair<const int, Entry>>(arena)), byName(), byUser() {}
+
+std::string EventIndex::lower(const char *text, size_t size)
+{
+    std::string result(text, size);
+    for (char &c : result)
+        c = std::tolower((unsigned char)c);
+    return result;
+}
+
+void EventIndex::add(const std::string &user, const EventList &events, const Event &event)
+{
+    Entry entry = {&user, &events, event.get_sort_key()};
+    byTime.insert(std::make_pair(event.get_time(), entry));
+    timeIndex(byName, lower(event.get_name().data(), event.get_name().size())).insert(std::make_pair(event.get_time(), entry));
+    timeIndex(byUser, user).insert(std::make_pair(event.get_time(), entry));
+}
+
+// The time index of key in indexes, created empty, on the arena, if there is none yet
+EventIndex::TimeIndex &EventIndex::timeIndex(std::unordered_map<std::string, TimeIndex> &indexes, const std::string &key)
+{
+    auto found = indexes.find(key);
+    if (found == indexes.end())
+        found = indexes.emplace(key, TimeIndex(byTime.get_allocator())).first;
+    return found->second;
+}
+
+void EventIndex::remove(const EventList &events, const Event &event)
+{
+    const std::string *user = erase(byTime, events, event);
+    if (user == nullptr)
+        return;
+    eraseFrom(byName, lower(event.get_name().data(), event.get_name().size()), events, event);
+    eraseFrom(byUser, *user, events, event);
+}
+
+// Removes the event's entry from index, returns the user it was filed under or nullptr if it had none
+const std::string *EventIndex::erase(TimeIndex &index, const EventList &events, const Event &event)
+{
+    auto range = index.equal_range(event.get_time());
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second.events == &events && it->second.sortKey == event.get_sort_key())
+        {
+            const std::string *user = it->second.user;
+            index.erase(it);
+            return user;
+        }
+    }
+    return nullptr;
+}
+
+void EventIndex::eraseFrom(std::unordered_map<std::string, TimeIndex> &indexes, const std::string &key,
+                           const EventList &events, const Event &event)
+{
+    auto found = indexes.find(key);
+    if (found == indexes.end())
+        return;
+    erase(found->second, events, event);
+    if (found->second.empty())
+        indexes.erase(found);
+}
+
+// Appends the entries of index in [from, to] to hits, only those whose lower-cased name
+// contains needle unless it is empty
+void EventIndex::collect(const TimeIndex &index, int from, int to, const std::string &needle, std::vector<Hit> &hits)
+{
+    for (auto it = index.lower_bound(from); it != index.end() && it->first <= to; ++it)
+    {
+        const Entry &entry = it->second;
+        auto found = std::lower_bound(entry.events->begin(), entry.events->end(), entry.sortKey,
+                                      [](const Event &event, uint64_t key) { return event.get_sort_key() < key; });
+        if (found == entry.events->end() || found->get_sort_key() != entry.sortKey)
+            continue;
+        if (!needle.empty() &&
+            lower(found->get_name().data(), found->get_name().size()).find(needle) == std::string::npos)
+            continue;
+        hits.push_back(Hit{entry.user, &*found});
+    }
+}
+
+std::vector<EventIndex::Hit> EventIndex::query(int from, int to, const std::string &nameFilter, const std::string &user) const
+{
+    std::vector<Hit> hits;
+    std::string needle = lower(nameFilter.data(), nameFilter.size());
+    // a user's own index holds only their events, already in time order
+    if (!user.empty())
+    {
+        auto own = byUser.find(user);
+        if (own != byUser.end())
+            collect(own->second, from, to, needle, hits);
+        return hits;
+    }
+    if (nameFilter.empty())
+    {
+        collect(byTime, from, to, "", hits);
+        return hits;
+    }
+
+    // distinct names are few next to the events, so matching them keeps queries flat as history grows
+    for (auto &named : byName)
+        if (named.first.find(needle) != std::string::npos)
+            collect(named.second, from, to, "", hits);
+    std::stable_sort(hits.begin(), hits.end(), [](const Hit &a, const Hit &b) {
+        return a.event->get_time() != b.event->get_time() ? a.event->get_time() < b.event->get_time()
+                                                          : a.event->get_sort_key() < b.event->get_sort_key();
+    });
+    return hits;
+}
+
+size_t EventIndex::size() const
+{
+    return byTime.size();
+}
+
+// A tree node per entry of every time index, taken as the entry plus four pointers like an
+// event's update map nodes, and the name and user tables' nodes and buckets
+size_t EventIndex::memoryUsage() const
+{
+    const size_t node = sizeof(TimeIndex::value_type) + 4 * sizeof(void *);
+    size_t bytes = byTime.size() * node;
+    for (const auto *indexes : {&byName, &byUser})
+    {
+        bytes += indexes->bucket_count() * sizeof(void *);
+        for (const auto &keyed : *indexes)
+            bytes += sizeof(keyed) + 2 * sizeof(void *) + keyed.first.capacity() + keyed.second.size() * node;
+    }
+    return bytes;
+}
+
+void EventIndex::abandon()
+{
+    if (arena == nullptr)
+        return;
+    arena->abandon(byTime);
+    for (auto *indexes : {&byName, &byUser})
+    {
+        for (auto &keyed : *indexes)
+            arena->abandon(keyed.second);
+        indexes->clear();
+    }
+}
@@ -0,0 +1,406 @@
+#include "../include/EventLog.h"
+#include "../include/EventCodec.h"
+#include "../include/PrivateDirectory.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <cctype>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const std::chrono::milliseconds EventLog::GROUP_COMMIT_INTERVAL(20);
+
+namespace
+{
+    const std::string SEGMENT_PREFIX = "segment-";
+    const std::string SEGMENT_SUFFIX = ".log";
+    const size_t RECORD_HEADER_BYTES = 8;
+
+    struct Crc32Table
+    {
+        uint32_t entries[256];
+
+        Crc32Table() : entries()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+        }
+    };
+
+    uint32_t crc32(const char *data, size_t size)
+    {
+        static const Crc32Table table;
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; i++)
+            crc = table.entries[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    void putUint32(std::string &out, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            out.push_back((char)((value >> (8 * i)) & 0xFF));
+    }
+
+    uint32_t getUint32(const char *data)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; i++)
+            value |= (uint32_t)(unsigned char)data[i] << (8 * i);
+        return value;
+    }
+
+    // Reads a length-prefixed field of a payload, false if it runs past the end
+    bool getField(const std::string &payload, size_t &pos, std::string &field)
+    {
+        if (payload.size() - pos < 4)
+            return false;
+        uint32_t length = getUint32(payload.data() + pos);
+        pos += 4;
+        if (payload.size() - pos < length)
+            return false;
+        field.assign(payload, pos, length);
+        pos += length;
+        return true;
+    }
+}
+
+EventLog::EventLog(const std::string &directory)
+    : directory(directory), lockFd(-1), segmentFd(-1), segmentSize(0), nextSegment(1), firstSegment(1), mutex(),
+      wake(), committed(), pending(), appendedBytes(0), committedBytes(0), flushing(false), closing(false),
+      failed(false), writer()
+{
+    if (this->directory.empty())
+        return;
+    if (!makePrivateDirectory(this->directory))
+    {
+        std::cout << "Error: Event log " << this->directory
+                  << " is not a directory private to this user, events will not be logged" << std::endl;
+        this->directory.clear();
+        return;
+    }
+
+    // one client per log: a second one would interleave its segments with ours
+    std::string lockPath = this->directory + "/lock";
+    lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT, 0600);
+    if (lockFd < 0 || flock(lockFd, LOCK_EX | LOCK_NB) != 0)
+    {
+        std::cout << "Error: Event log " << this->directory << " is in use or unavailable, events will not be logged" << std::endl;
+        if (lockFd >= 0)
+            close(lockFd);
+        lockFd = -1;
+        this->directory.clear();
+        return;
+    }
+
+    for (const std::string &path : segmentPaths())
+        nextSegment = std::max(nextSegment, segmentNumber(path) + 1);
+    firstSegment = nextSegment;
+    writer = std::thread(&EventLog::writeLoop, this);
+}
+
+EventLog::~EventLog()
+{
+    if (!enabled())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+        wake.notify_one();
+    }
+    writer.join();
+    if (segmentFd >= 0)
+        close(segmentFd);
+    close(lockFd);
+}
+
+std::string EventLog::defaultDirectory()
+{
+    const char *dir = std::getenv("STOMP_EVENT_LOG");
+    return dir != nullptr ? dir : "";
+}
+
+std::string EventLog::userDirectory(const std::string &user)
+{
+    std::string base = defaultDirectory();
+    if (base.empty())
+        return base;
+    // whoever can write to the base could swap the user's directory for their own
+    if (!makePrivateDirectory(base))
+    {
+        std::cout << "Error: Event log " << base
+                  << " is not a directory private to this user, events will not be logged" << std::endl;
+        return "";
+    }
+    // anything but letters, digits, '-' and '_' is escaped, so no user name can leave the base
+    std::string name;
+    for (char c : user)
+    {
+        if (std::isalnum((unsigned char)c) || c == '-' || c == '_')
+        {
+            name += c;
+        }
+        else
+        {
+            char escaped[4];
+            snprintf(escaped, sizeof(escaped), "%%%02X", (unsigned char)c);
+            name += escaped;
+        }
+    }
+    return base + "/user-" + name;
+}
+
+bool EventLog::enabled() const
+{
+    return !directory.empty();
+}
+
+std::vector<std::string> EventLog::segmentPaths()
+{
+    std::vector<std::string> paths;
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        return paths;
+    while (struct dirent *entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (name.size() > SEGMENT_PREFIX.size() + SEGMENT_SUFFIX.size() && name.compare(0, SEGMENT_PREFIX.size(), SEGMENT_PREFIX) == 0 &&
+            name.compare(name.size() - SEGMENT_SUFFIX.size(), SEGMENT_SUFFIX.size(), SEGMENT_SUFFIX) == 0)
+            paths.push_back(directory + "/" + name);
+    }
+    closedir(dir);
+    // segment numbers are zero padded, so name order is log order
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+unsigned EventLog::segmentNumber(const std::string &path)
+{
+    size_t start = path.rfind('/') + 1 + SEGMENT_PREFIX.size();
+    return (unsigned)std::strtoul(path.c_str() + start, nullptr, 10);
+}
+
+EventLog::ReplayCounts EventLog::replay(const Handlers &handlers)
+{
+    ReplayCounts counts = {0, 0, 0};
+    if (!enabled())
+        return counts;
+
+    for (const std::string &path : segmentPaths())
+    {
+        counts.segments++;
+        std::ifstream in(path, std::ios::binary);
+        in.seekg(0, std::ios::end);
+        std::string data((size_t)in.tellg(), '\0');
+        in.seekg(0, std::ios::beg);
+        in.read(&data[0], data.size());
+
+        size_t pos = 0;
+        std::string payload, gameName, user, encoded, teamA, teamB, count;
+        while (pos < data.size())
+        {
+            if (data.size() - pos < RECORD_HEADER_BYTES)
+                break;
+            uint32_t length = getUint32(data.data() + pos);
+            uint32_t checksum = getUint32(data.data() + pos + 4);
+            if (data.size() - pos - RECORD_HEADER_BYTES < length ||
+                crc32(data.data() + pos + RECORD_HEADER_BYTES, length) != checksum || length == 0)
+                break;
+            payload.assign(data, pos + RECORD_HEADER_BYTES, length);
+
+            size_t field = 1;
+            if (payload[0] == RECORD_EVENT && getField(payload, field, gameName) && getField(payload, field, user) &&
+                getField(payload, field, encoded))
+            {
+                try
+                {
+                    Event event = decodeEvent(encoded);
+                    handlers.event(gameName, user, event);
+                    counts.events++;
+                }
+                catch (const std::runtime_error &)
+                {
+                    break;
+                }
+            }
+            else if (payload[0] == RECORD_RELEASE && getField(payload, field, gameName))
+                handlers.release(gameName);
+            else if (payload[0] == RECORD_EVICT && getField(payload, field, gameName) && getField(payload, field, user) &&
+                     getField(payload, field, count))
+                handlers.evict(gameName, user, std::strtoull(count.c_str(), nullptr, 10));
+            else if (payload[0] == RECORD_CHECKPOINT)
+                handlers.checkpoint();
+            else if (payload[0] == RECORD_STATS && getField(payload, field, gameName) && getField(payload, field, user) &&
+                     getField(payload, field, teamA) && getField(payload, field, teamB) &&
+                     getField(payload, field, count) && getField(payload, field, encoded))
+            {
+                try
+                {
+                    GameStats stats = decodeGameStats(encoded);
+                    handlers.stats(gameName, user, teamA, teamB, std::strtoull(count.c_str(), nullptr, 10), stats);
+                }
+                catch (const std::runtime_error &)
+                {
+                    break;
+                }
+            }
+            else
+                break;
+            counts.records++;
+            pos += RECORD_HEADER_BYTES + length;
+        }
+        if (pos < data.size())
+            std::cout << "Event log: ignored damaged records at the end of " << path << " from offset " << pos << std::endl;
+    }
+    return counts;
+}
+
+void EventLog::appendEvent(const std::string &gameName, const std::string &user, const Event &event)
+{
+    if (!enabled())
+        return;
+    std::string encoded = encodeEvent(event);
+    append(RECORD_EVENT, {&gameName, &user, &encoded});
+}
+
+void EventLog::appendRelease(const std::string &gameName)
+{
+    if (!enabled())
+        return;
+    append(RECORD_RELEASE, {&gameName});
+}
+
+void EventLog::appendEvict(const std::string &gameName, const std::string &user, size_t count)
+{
+    if (!enabled())
+        return;
+    std::string countField = std::to_string(count);
+    append(RECORD_EVICT, {&gameName, &user, &countField});
+}
+
+void EventLog::appendStats(const std::string &gameName, const std::string &user, const std::string &teamA,
+                           const std::string &teamB, size_t evicted, const GameStats &stats)
+{
+    if (!enabled())
+        return;
+    std::string evictedField = std::to_string(evicted);
+    std::string encoded = encodeGameStats(stats);
+    append(RECORD_STATS, {&gameName, &user, &teamA, &teamB, &evictedField, &encoded});
+}
+
+void EventLog::checkpoint(const std::function<void()> &writeState)
+{
+    if (!enabled())
+        return;
+    append(RECORD_CHECKPOINT, {});
+    writeState();
+    // the old segments are the only copy until the checkpoint is on disk
+    if (!flush())
+        return;
+    for (const std::string &path : segmentPaths())
+        if (segmentNumber(path) < firstSegment)
+            std::remove(path.c_str());
+}
+
+void EventLog::append(RecordKind kind, const std::vector<const std::string *> &fields)
+{
+    std::string payload(1, (char)kind);
+    for (const std::string *field : fields)
+    {
+        putUint32(payload, field->size());
+        payload += *field;
+    }
+    std::string record;
+    record.reserve(RECORD_HEADER_BYTES + payload.size());
+    putUint32(record, payload.size());
+    putUint32(record, crc32(payload.data(), payload.size()));
+    record += payload;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending += record;
+    appendedBytes += record.size();
+    if (pending.size() >= GROUP_COMMIT_BYTES)
+        wake.notify_one();
+}
+
+bool EventLog::flush()
+{
+    if (!enabled())
+        return true;
+    std::unique_lock<std::mutex> lock(mutex);
+    unsigned long long target = appendedBytes;
+    flushing = true;
+    wake.notify_one();
+    committed.wait(lock, [this, target]() { return committedBytes >= target; });
+    return !failed;
+}
+
+bool EventLog::openSegment()
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%08u", nextSegment++);
+    std::string path = directory + "/" + SEGMENT_PREFIX + name + SEGMENT_SUFFIX;
+    segmentFd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+    segmentSize = 0;
+    return segmentFd >= 0;
+}
+
+// Commits pending records in groups until the log is closed
+void EventLog::writeLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        wake.wait_for(lock, GROUP_COMMIT_INTERVAL,
+                      [this]() { return closing || flushing || pending.size() >= GROUP_COMMIT_BYTES; });
+        if (pending.empty())
+        {
+            flushing = false;
+            if (closing)
+                break;
+            continue;
+        }
+        std::string group;
+        group.swap(pending);
+        unsigned long long upTo = appendedBytes;
+        flushing = false;
+        lock.unlock();
+
+        bool ok = segmentFd >= 0 || openSegment();
+        for (size_t written = 0; ok && written < group.size();)
+        {
+            ssize_t n = write(segmentFd, group.data() + written, group.size() - written);
+            if (n < 0)
+                ok = false;
+            else
+                written += n;
+        }
+        ok = ok && fdatasync(segmentFd) == 0;
+        if (!ok && !failed)
+            std::cout << "Error: Could not write to event log " << directory << std::endl;
+        segmentSize += group.size();
+        if (segmentFd >= 0 && segmentSize >= SEGMENT_BYTES)
+        {
+            close(segmentFd);
+            segmentFd = -1;
+        }
+
+        lock.lock();
+        // sticky, a checkpoint must not delete the old segments after any lost group
+        failed = failed || !ok;
+        committedBytes = upTo;
+        committed.notify_all();
+    }
+}
@@ -0,0 +1,212 @@
+#include "../include/ExternalEventSorter.h"
+#include "../include/EventCodec.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <functional>
+#include <iterator>
+
+namespace
+{
+    bool bySortKey(const Event &e1, const Event &e2)
+    {
+        return e1.get_sort_key() < e2.get_sort_key();
+    }
+
+    void putUint(std::ofstream &out, uint64_t value, int bytes)
+    {
+        char buffer[8];
+        for (int i = 0; i < bytes; i++)
+            buffer[i] = (char)((value >> (8 * i)) & 0xFF);
+        out.write(buffer, bytes);
+    }
+
+    bool getUint(std::ifstream &in, uint64_t &value, int bytes)
+    {
+        unsigned char buffer[8];
+        if (!in.read(reinterpret_cast<char *>(buffer), bytes))
+            return false;
+        value = 0;
+        for (int i = 0; i < bytes; i++)
+            value |= (uint64_t)buffer[i] << (8 * i);
+        return true;
+    }
+}
+
+ExternalEventSorter::ExternalEventSorter(size_t windowEvents)
+    : windowEvents(windowEvents), directory(), window(), runs(), heap(), nextRunId(0), windowPos(0), finished(false)
+{
+    window.reserve(windowEvents);
+}
+
+ExternalEventSorter::Run::~Run()
+{
+    in.close();
+    if (!path.empty())
+        std::remove(path.c_str());
+}
+
+ExternalEventSorter::~ExternalEventSorter()
+{
+    runs.clear();
+    if (!directory.empty())
+        rmdir(directory.c_str());
+}
+
+void ExternalEventSorter::add(Event &event)
+{
+    window.push_back(std::move(event));
+    if (window.size() >= windowEvents)
+        spill();
+}
+
+// Run record: sort key (8 bytes), encoded event length (4 bytes), encoded event; little-endian
+void ExternalEventSorter::spill()
+{
+    if (window.empty())
+        return;
+    if (directory.empty())
+    {
+        char pattern[] = "/tmp/stomp-runs-XXXXXX";
+        if (mkdtemp(pattern) == nullptr)
+            throw std::runtime_error("external sort: cannot create a temporary directory");
+        directory = pattern;
+    }
+
+    std::sort(window.begin(), window.end(), bySortKey);
+    runs.push_back(std::unique_ptr<Run>(new Run()));
+    Run *run = runs.back().get();
+    run->path = directory + "/run" + std::to_string(nextRunId++);
+    {
+        std::ofstream out(run->path, std::ios::binary | std::ios::trunc);
+        for (const Event &event : window)
+        {
+            std::string record = encodeEvent(event);
+            putUint(out, event.get_sort_key(), 8);
+            putUint(out, record.size(), 4);
+            out.write(record.data(), record.size());
+        }
+        if (!out)
+            throw std::runtime_error("external sort: cannot write " + run->path);
+    }
+    window.clear();
+}
+
+void ExternalEventSorter::advance(Run &run)
+{
+    uint64_t length = 0;
+    run.hasHead = getUint(run.in, run.headKey, 8) && getUint(run.in, length, 4);
+    if (!run.hasHead)
+        return;
+    run.headRecord.resize(length);
+    if (!run.in.read(&run.headRecord[0], length))
+        throw std::runtime_error("external sort: truncated run " + run.path);
+}
+
+void ExternalEventSorter::openRuns(RunGroup &group)
+{
+    heap.clear();
+    for (size_t i = 0; i < group.size(); i++)
+    {
+        group[i]->in.open(group[i]->path, std::ios::binary);
+        advance(*group[i]);
+        if (group[i]->hasHead)
+            heap.push_back(std::make_pair(group[i]->headKey, i));
+    }
+    std::make_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+}
+
+// Pops the smallest head of the group being merged: sets index to its run, whose headRecord
+// holds it, false once every run is exhausted
+bool ExternalEventSorter::popSmallest(size_t &index)
+{
+    if (heap.empty())
+        return false;
+    std::pop_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+    index = heap.back().second;
+    heap.pop_back();
+    return true;
+}
+
+void ExternalEventSorter::pushNext(RunGroup &group, size_t index)
+{
+    Run &run = *group[index];
+    advance(run);
+    if (!run.hasHead)
+        return;
+    heap.push_back(std::make_pair(run.headKey, index));
+    std::push_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+}
+
+// Merges the oldest MAX_FAN_IN runs into one until few enough remain to be read back together
+void ExternalEventSorter::reduceRuns()
+{
+    while (runs.size() > MAX_FAN_IN)
+    {
+        // the group's files go when group does, whether the merge finishes or throws
+        RunGroup group(std::make_move_iterator(runs.begin()), std::make_move_iterator(runs.begin() + MAX_FAN_IN));
+        runs.erase(runs.begin(), runs.begin() + MAX_FAN_IN);
+
+        runs.push_back(std::unique_ptr<Run>(new Run()));
+        Run *merged = runs.back().get();
+        merged->path = directory + "/run" + std::to_string(nextRunId++);
+        {
+            std::ofstream out(merged->path, std::ios::binary | std::ios::trunc);
+            openRuns(group);
+            size_t index;
+            while (popSmallest(index))
+            {
+                const Run &run = *group[index];
+                putUint(out, run.headKey, 8);
+                putUint(out, run.headRecord.size(), 4);
+                out.write(run.headRecord.data(), run.headRecord.size());
+                pushNext(group, index);
+            }
+            if (!out)
+                throw std::runtime_error("external sort: cannot write " + merged->path);
+        }
+    }
+}
+
+void ExternalEventSorter::finish()
+{
+    if (finished)
+        return;
+    finished = true;
+    if (runs.empty())
+    {
+        std::sort(window.begin(), window.end(), bySortKey);
+        return;
+    }
+    spill();
+    reduceRuns();
+    openRuns(runs);
+}
+
+bool ExternalEventSorter::next(std::vector<Event> &out, size_t max)
+{
+    size_t added = 0;
+    if (runs.empty())
+    {
+        for (; added < max && windowPos < window.size(); added++)
+            out.push_back(std::move(window[windowPos++]));
+        if (windowPos == window.size())
+            std::vector<Event>().swap(window);
+        return added > 0;
+    }
+
+    size_t index;
+    for (; added < max && popSmallest(index); added++)
+    {
+        out.push_back(decodeEvent(runs[index]->headRecord));
+        pushNext(runs, index);
+    }
+    return added > 0;
+}
+
+size_t ExternalEventSorter::runCount() const
+{
+    return runs.size();
+}
@@ -0,0 +1,90 @@
+#include "../include/GameArena.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <sys/mman.h>
+
+namespace
+{
+    const size_t PAGE_BYTES = 4096;
+
+    // Maps size bytes, aligned to size and huge page backed if huge is set and the kernel obliges
+    char *mapChunk(size_t size, bool huge)
+    {
+        const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (!huge)
+        {
+            void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+            return mapped == MAP_FAILED ? nullptr : static_cast<char *>(mapped);
+        }
+
+        // reserved huge pages first, then transparent ones on an aligned slice of a double mapping
+        void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (mapped != MAP_FAILED)
+            return static_cast<char *>(mapped);
+        mapped = mmap(nullptr, 2 * size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (mapped == MAP_FAILED)
+            return nullptr;
+        char *raw = static_cast<char *>(mapped);
+        char *aligned = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(raw) + size - 1) & ~(uintptr_t)(size - 1));
+        if (aligned > raw)
+            munmap(raw, aligned - raw);
+        if (raw + size > aligned)
+            munmap(aligned + size, raw + size - aligned);
+        madvise(aligned, size, MADV_HUGEPAGE);
+        return aligned;
+    }
+}
+
+GameArena::GameArena(bool hugePages)
+    : chunks(), cursor(nullptr), limit(nullptr), nextChunk(CHUNK_MIN_BYTES), hugePages(hugePages), reserved(0),
+      used(0), released(0)
+{
+}
+
+GameArena::~GameArena()
+{
+    for (const Chunk &chunk : chunks)
+        munmap(chunk.base, chunk.size);
+}
+
+bool GameArena::hugePagesRequested()
+{
+    const char *value = std::getenv("STOMP_ARENA_HUGEPAGES");
+    return value != nullptr && *value != '\0' && *value != '0';
+}
+
+// Maps the next chunk and makes it the current one, or maps one of exactly the rounded up size
+// for a single big block without touching the current chunk
+char *GameArena::addChunk(size_t dedicatedBytes)
+{
+    size_t size = dedicatedBytes > 0 ? (dedicatedBytes + PAGE_BYTES - 1) & ~(PAGE_BYTES - 1) : nextChunk;
+    char *base = mapChunk(size, hugePages && size == CHUNK_MAX_BYTES);
+    if (base == nullptr)
+        throw std::bad_alloc();
+    chunks.push_back(Chunk{base, size});
+    reserved += size;
+    if (dedicatedBytes == 0)
+    {
+        cursor = base;
+        limit = base + size;
+        nextChunk = std::min(nextChunk * 2, (size_t)CHUNK_MAX_BYTES);
+    }
+    return base;
+}
+
+void *GameArena::allocate(size_t bytes, size_t alignment)
+{
+    used += bytes;
+    // big blocks get a chunk of their own, the current chunk keeps serving small ones
+    if (bytes > nextChunk / 4)
+        return addChunk(bytes);
+    uintptr_t start = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (cursor == nullptr || start + bytes > reinterpret_cast<uintptr_t>(limit))
+    {
+        addChunk(0);
+        start = reinterpret_cast<uintptr_t>(cursor);
+    }
+    cursor = reinterpret_cast<char *>(start + bytes);
+    return reinterpret_cast<void *>(start);
+}
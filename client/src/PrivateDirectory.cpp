@@ -0,0 +1,30 @@
+#include "../include/PrivateDirectory.h"
+#include <cstdlib>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string userCacheDirectory(const std::string &name)
+{
+    const char *cache = std::getenv("XDG_CACHE_HOME");
+    if (cache != nullptr && cache[0] == '/')
+        return std::string(cache) + "/stomp-client/" + name;
+    const char *home = std::getenv("HOME");
+    if (home != nullptr && home[0] != '\0')
+        return std::string(home) + "/.cache/stomp-client/" + name;
+    return "";
+}
+
+bool makePrivateDirectory(const std::string &path)
+{
+    if (path.empty())
+        return false;
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+        mkdir(path.substr(0, slash).c_str(), 0700);
+    if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST)
+        return false;
+
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() &&
+           (st.st_mode & 0777) == 0700;
+}
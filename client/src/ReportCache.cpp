@@ -0,0 +1,215 @@
+#include "../include/ReportCache.h"
+#include "../include/EventCodec.h"
+#include "../include/PrivateDirectory.h"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <tuple>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <unistd.h>
+
+bool ReportCache::FileStamp::operator==(const FileStamp &other) const
+{
+    return size == other.size && mtimeSec == other.mtimeSec && mtimeNsec == other.mtimeNsec;
+}
+
+ReportCache::ReportCache(const std::string &directory)
+    : directory(directory), mutex(), entries(), recentPaths(), memoryBytes(0)
+{
+    if (!this->directory.empty() && !makePrivateDirectory(this->directory))
+    {
+        std::cout << "Error: Report cache " << this->directory
+                  << " is not a directory private to this user, reports are cached in memory only" << std::endl;
+        this->directory.clear();
+    }
+}
+
+std::string ReportCache::defaultDirectory()
+{
+    const char *dir = std::getenv("STOMP_REPORT_CACHE");
+    if (dir != nullptr)
+        return dir;
+    return userCacheDirectory("reports");
+}
+
+bool ReportCache::statFile(const std::string &path, FileStamp &stamp)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    stamp.size = st.st_size;
+    stamp.mtimeSec = st.st_mtim.tv_sec;
+    stamp.mtimeNsec = st.st_mtim.tv_nsec;
+    return true;
+}
+
+std::string ReportCache::diskPath(const std::string &path)
+{
+    std::stringstream ss;
+    ss << directory << "/" << std::hex << std::hash<std::string>()(path) << ".bin";
+    return ss.str();
+}
+
+ReportCache::Report ReportCache::lookup(const std::string &path, const FileStamp &stamp)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(path);
+        if (it != entries.end())
+        {
+            if (it->second.stamp == stamp)
+            {
+                recentPaths.splice(recentPaths.begin(), recentPaths, it->second.recent);
+                return it->second.report;
+            }
+            forget(it);
+        }
+    }
+
+    Report report = loadFromDisk(path, stamp);
+    if (report)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        remember(path, stamp, report);
+    }
+    return report;
+}
+
+void ReportCache::store(const std::string &path, const FileStamp &stamp, const Report &report)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        remember(path, stamp, report);
+    }
+    saveToDisk(path, stamp, *report);
+}
+
+// Makes report the most recent entry for path, then drops the least recent ones while the
+// events held exceed MEMORY_BYTES. A report bigger than that on its own is not kept. Caller locks.
+void ReportCache::remember(const std::string &path, const FileStamp &stamp, const Report &report)
+{
+    auto it = entries.find(path);
+    if (it != entries.end())
+        forget(it);
+
+    size_t bytes = sizeof(names_and_events);
+    for (const Event &event : report->events)
+        bytes += event.memory_usage();
+    if (bytes > MEMORY_BYTES)
+        return;
+
+    Entry &entry = entries[path];
+    entry.stamp = stamp;
+    entry.report = report;
+    entry.bytes = bytes;
+    entry.recent = recentPaths.insert(recentPaths.begin(), path);
+    memoryBytes += bytes;
+    while (memoryBytes > MEMORY_BYTES)
+        forget(entries.find(recentPaths.back()));
+}
+
+void ReportCache::forget(std::map<std::string, Entry>::iterator it)
+{
+    memoryBytes -= it->second.bytes;
+    recentPaths.erase(it->second.recent);
+    entries.erase(it);
+}
+
+// On-disk entry: the source path and its stamp on the first two lines, then the encoded report
+ReportCache::Report ReportCache::loadFromDisk(const std::string &path, const FileStamp &stamp)
+{
+    if (directory.empty())
+        return Report();
+    std::string file = diskPath(path);
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+        return Report();
+
+    std::string cachedPath;
+    FileStamp cachedStamp;
+    std::getline(in, cachedPath);
+    in >> cachedStamp.size >> cachedStamp.mtimeSec >> cachedStamp.mtimeNsec;
+    in.ignore(1);
+    if (!in || cachedPath != path || !(cachedStamp == stamp))
+        return Report();
+
+    std::string buffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    try
+    {
+        Report report = std::make_shared<const names_and_events>(decodeReport(buffer));
+        // the modification time tells pruneDisk when the copy was last used
+        utimes(file.c_str(), nullptr);
+        return report;
+    }
+    catch (std::exception &e)
+    {
+        return Report();
+    }
+}
+
+void ReportCache::saveToDisk(const std::string &path, const FileStamp &stamp, const names_and_events &report)
+{
+    if (directory.empty())
+        return;
+    // unique per process and per save, so concurrent saves of one path never share a temp file
+    static std::atomic<unsigned long> saves(0);
+    std::string target = diskPath(path);
+    std::string temp = target + ".tmp" + std::to_string(getpid()) + "." + std::to_string(saves++);
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return;
+        out << path << "\n" << stamp.size << " " << stamp.mtimeSec << " " << stamp.mtimeNsec << "\n";
+        out << encodeReport(report);
+        if (!out)
+        {
+            out.close();
+            std::remove(temp.c_str());
+            return;
+        }
+    }
+    if (std::rename(temp.c_str(), target.c_str()) != 0)
+        std::remove(temp.c_str());
+    pruneDisk();
+}
+
+// Removes the copies, and temp files a crash left behind, unused for DISK_MAX_AGE, then the
+// least recently used ones while the rest take more than DISK_BYTES
+void ReportCache::pruneDisk()
+{
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        return;
+    // (last use, path, size) of every file
+    std::vector<std::tuple<time_t, std::string, off_t>> files;
+    off_t total = 0;
+    time_t now = time(nullptr);
+    while (struct dirent *entry = readdir(dir))
+    {
+        std::string file = directory + "/" + entry->d_name;
+        struct stat st;
+        if (lstat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        if (now - st.st_mtime > DISK_MAX_AGE)
+        {
+            std::remove(file.c_str());
+            continue;
+        }
+        files.push_back(std::make_tuple(st.st_mtime, file, st.st_size));
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    std::sort(files.begin(), files.end());
+    for (size_t i = 0; i < files.size() && total > DISK_BYTES; i++)
+        if (std::remove(std::get<1>(files[i]).c_str()) == 0)
+            total -= std::get<2>(files[i]);
+}
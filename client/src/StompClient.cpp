@@ -13,8 +13,15 @@ using std::string;
 using std::vector;
 #include "../include/ConnectionHandler.h"
 #include "../include/StompProtocol.h"
+#include "../include/SpscRing.h"
 
-void getFramesFromServer(ConnectionHandler*, StompProtocol&, volatile bool&);
+// frames buffered between the socket reader and the frame processor, and the most frames
+// the processor takes per batch
+const size_t FRAME_RING_CAPACITY = 1024;
+const size_t FRAME_BATCH_SIZE = 64;
+
+void getFramesFromServer(ConnectionHandler*, SpscRing<string>&, volatile bool&);
+void processFrames(SpscRing<string>&, StompProtocol&, ConnectionHandler*, volatile bool&);
 ConnectionHandler* handleLogin(string&, string);
 vector<string> split(const string&, char);
 
@@ -37,7 +44,10 @@ int main(int argc, char *argv[])
         stompProtocol.setUsername(username);
 
         volatile bool shouldTerminate = false;
-        std::thread listener(getFramesFromServer, connectionHandler, std::ref(stompProtocol), std::ref(shouldTerminate));
+        SpscRing<string> frames(FRAME_RING_CAPACITY);
+        std::thread listener(getFramesFromServer, connectionHandler, std::ref(frames), std::ref(shouldTerminate));
+        std::thread processor(processFrames, std::ref(frames), std::ref(stompProtocol), connectionHandler,
+                              std::ref(shouldTerminate));
 
         while (!shouldTerminate) {
             const short bufsize = 1024;
@@ -57,26 +67,59 @@ int main(int argc, char *argv[])
             stompProtocol.processKeyboardCommand(line, connectionHandler);
         }
         if (listener.joinable()) listener.join();
+        if (processor.joinable()) processor.join();
         delete connectionHandler;
     }
 	return 0;
 }
 
-void getFramesFromServer(ConnectionHandler* connectionHandler, StompProtocol& stompProtocol, volatile bool& shouldTerminate)
+// Reads frames off the socket and hands them to the processor; never touches protocol state,
+// so a busy keyboard thread cannot stall the socket. The server closes the connection after an
+// ERROR frame, so the reader stops there instead of waiting for the end of file
+void getFramesFromServer(ConnectionHandler* connectionHandler, SpscRing<string>& frames, volatile bool& shouldTerminate)
 {
 	while (!shouldTerminate) {
 		string frame;
-		if (!connectionHandler->getFrameAscii(frame, '\0')) {
-			cout << "Disconnected. Exiting...\n" << endl;
-			shouldTerminate = true;
-			break;
+		if (!connectionHandler->getFrameAscii(frame, '\0')) break;
+		size_t start = frame.find_first_not_of("\r\n");
+		bool error = start != string::npos && frame.compare(start, 6, "ERROR\n") == 0;
+		if (!frames.push(std::move(frame)) || error) break;
+	}
+	frames.close();
+}
+
+// Applies the frames the reader queued, in batches. A DISCONNECT receipt or an ERROR shuts the
+// connection down, which wakes the reader out of its blocking read; a closed and drained ring
+// without either means the connection dropped. Reports how full the ring got
+void processFrames(SpscRing<string>& frames, StompProtocol& stompProtocol, ConnectionHandler* connectionHandler,
+                   volatile bool& shouldTerminate)
+{
+	vector<string> batch;
+	batch.reserve(FRAME_BATCH_SIZE);
+	bool running = true;
+	while (running && frames.popBatch(batch, FRAME_BATCH_SIZE) > 0) {
+		for (const string& frame : batch) {
+			if (!stompProtocol.processServerFrame(frame)) {
+				cout << "Disconnected.\n" << endl;
+				shouldTerminate = true;
+				running = false;
+				connectionHandler->shutdown();
+				break;
+			}
 		}
+		batch.clear();
+	}
+	frames.close();
+	stompProtocol.endSession();
+	if (running) {
+		cout << "Disconnected. Exiting...\n" << endl;
+		shouldTerminate = true;
+	}
 
-		if (!stompProtocol.processServerFrame(frame)) {
-            cout << "Disconnected.\n" << endl;
-            shouldTerminate = true;
-            break;
-        }
+	if (frames.pushedCount() > 0) {
+		cout << "Frame ring: " << frames.pushedCount() << " frames in " << frames.batchCount()
+		     << " batches, peak occupancy " << frames.peakOccupancy() << " of " << frames.capacity()
+		     << ", reader waited on a full ring " << frames.fullWaitCount() << " times" << endl;
 	}
 }
 
@@ -1,12 +1,161 @@
 #include "../include/StompProtocol.h"
+#include "../include/EventCodec.h"
+#include "../include/ExternalEventSorter.h"
 #include <regex.h>
+#include <glob.h>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <cstdlib>
+#include <climits>
+#include <cstdint>
+
+const std::chrono::seconds StompProtocol::REPORT_ACK_TIMEOUT(5);
 
 StompProtocol::StompProtocol() : 
     username(""), subIdCounter(0), receiptIdCounter(0), shouldTerminate(false), mutex(), 
-    subscriptions(), pendingReceipts(), gameUpdates() {}
+    subscriptions(), pendingReceipts(), exitReceipts(), gamesMutex(), gameUpdates(), retention(), storedBytes(0), useClock(0),
+    publishedMutex(), publishedEvents(), reportWindows(), acknowledgedFrames(0), receiptArrived(),
+    reportCache(ReportCache::defaultDirectory()), eventLog(), replaying(false),
+    summaryJobs(SUMMARY_QUEUE_CAPACITY), summaryWriters(), summaryFilesMutex(), summaryFileDone(), summaryFiles() {
+    for (size_t i = 0; i < SUMMARY_WRITERS; i++)
+        summaryWriters.push_back(std::thread(&StompProtocol::writeSummaries, this));
+}
+
+StompProtocol::~StompProtocol() {
+    summaryJobs.close();
+    for (std::thread& writer : summaryWriters)
+        writer.join();
+}
+
+// Opens the logged in user's event log and rebuilds the stored game data from it. Data held
+// for a previous user goes first, it was received under that user's subscriptions. Retention
+// applies to the replayed data as a whole, and a log holding much more history than data is
+// rewritten as a checkpoint.
+void StompProtocol::recoverEvents() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    eventLog.reset();
+    dropAllGames();
+    eventLog.reset(new EventLog(EventLog::userDirectory(username)));
+
+    EventLog::Handlers handlers;
+    handlers.event = [this](const string& gameName, const string& user, Event& event) { storeEvent(gameName, user, event); };
+    handlers.release = [this](const string& gameName) { dropGame(gameName); };
+    handlers.evict = [this](const string& gameName, const string& user, size_t count) { replayEviction(gameName, user, count); };
+    handlers.checkpoint = [this]() { dropAllGames(); };
+    handlers.stats = [this](const string& gameName, const string& user, const string& teamA, const string& teamB,
+                            size_t evicted, GameStats& stats) { replayStats(gameName, user, teamA, teamB, evicted, stats); };
+    replaying = true;
+    EventLog::ReplayCounts counts = eventLog->replay(handlers);
+    replaying = false;
+    vector<std::pair<string, std::shared_ptr<GameShard>>> games = enforceRetention();
+
+    size_t live = 0;
+    for (auto& pair : games) {
+        std::lock_guard<std::mutex> lock(pair.second->mutex);
+        live += pair.second->events + pair.second->users.size();
+    }
+    if (counts.events > 0) {
+        cout << "Recovered " << counts.events << " events for " << games.size() << " games from the event log in "
+             << elapsedNanos(start) / 1000000 << " ms" << endl;
+    }
+    if (counts.segments > LOG_COMPACT_SEGMENTS || (counts.records >= LOG_COMPACT_MIN_RECORDS && counts.records >= 2 * live))
+        checkpointEventLog();
+}
+
+void StompProtocol::replayEviction(const string& gameName, const string& user, size_t count) {
+    std::shared_ptr<GameShard> game = findGame(gameName, false);
+    if (game == nullptr)
+        return;
+    std::lock_guard<std::mutex> lock(game->mutex);
+    auto slot = game->users.find(user);
+    if (game->released || slot == game->users.end())
+        return;
+    evictFront(*game, slot->first, slot->second, std::min(count, slot->second.stats.events.size()));
+    compactArena(*game);
+}
+
+// A checkpoint's stats record follows the user's events and replaces what merging them gave,
+// since the logged stats also hold the updates of events evicted before the checkpoint
+void StompProtocol::replayStats(const string& gameName, const string& user, const string& teamA, const string& teamB,
+                                size_t evicted, GameStats& stats) {
+    std::shared_ptr<GameShard> game = findGame(gameName, true);
+    std::lock_guard<std::mutex> lock(game->mutex);
+    if (game->released)
+        return;
+    auto slot = game->users.find(user);
+    if (slot == game->users.end())
+        slot = game->users.insert(std::make_pair(user, UserGame(game->arena.get()))).first;
+    UserGame& userGame = slot->second;
+    userGame.teamA = teamA;
+    userGame.teamB = teamB;
+    userGame.evicted = evicted;
+    userGame.stats.generalStats.swap(stats.generalStats);
+    userGame.stats.teamAStats.swap(stats.teamAStats);
+    userGame.stats.teamBStats.swap(stats.teamBStats);
+    for (auto& format : userGame.rendered)
+        format.second.headDirty = true;
+}
+
+// Rewrites the event log as the data held now: for every game and user the stored events, then
+// the user's stats
+void StompProtocol::checkpointEventLog() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t records = 0;
+    eventLog->checkpoint([this, &records]() {
+        vector<std::pair<string, std::shared_ptr<GameShard>>> games;
+        {
+            std::lock_guard<std::mutex> lock(gamesMutex);
+            games.assign(gameUpdates.begin(), gameUpdates.end());
+        }
+        for (auto& pair : games) {
+            std::lock_guard<std::mutex> lock(pair.second->mutex);
+            for (auto& user : pair.second->users) {
+                for (const Event& event : user.second.stats.events)
+                    eventLog->appendEvent(pair.first, user.first, event);
+                GameStats stats;
+                stats.generalStats = user.second.stats.generalStats;
+                stats.teamAStats = user.second.stats.teamAStats;
+                stats.teamBStats = user.second.stats.teamBStats;
+                eventLog->appendStats(pair.first, user.first, user.second.teamA, user.second.teamB, user.second.evicted, stats);
+                records += user.second.stats.events.size() + 1;
+            }
+        }
+    });
+    cout << "Event log: wrote a checkpoint of " << records << " records in " << elapsedNanos(start) / 1000000
+         << " ms" << endl;
+}
 
+// Starts the session of a new login. Receipts and subscriptions of an earlier connection will
+// never be answered on this one, so they go with what it published, and a DISCONNECT seen
+// there no longer applies.
+// A different user than before gets their own stored data, from their event log.
 void StompProtocol::setUsername(string username) {
-    this->username = username;
+    bool newUser = eventLog == nullptr || username != this->username;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->username = username;
+        shouldTerminate = false;
+        subscriptions.clear();
+        pendingReceipts.clear();
+        exitReceipts.clear();
+        reportWindows.clear();
+    }
+    {
+        std::lock_guard<std::mutex> publishedLock(publishedMutex);
+        publishedEvents.clear();
+    }
+    if (newUser)
+        recoverEvents();
+}
+
+// Ends the current session once its connection is gone, waking a report waiting on receipts
+void StompProtocol::endSession() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shouldTerminate = true;
+    }
+    receiptArrived.notify_all();
 }
 
 void StompProtocol::sendFrame(ConnectionHandler* handler, string frame) {
@@ -14,6 +163,7 @@ void StompProtocol::sendFrame(ConnectionHandler* handler, string frame) {
     if (!handler->sendFrameAscii(frame, '\0')) {
         cout << "Error: Connection lost while sending frame" << endl;
         shouldTerminate = true;
+        receiptArrived.notify_all();
     }
 }
 
@@ -37,14 +187,121 @@ void StompProtocol::processKeyboardCommand(const string& commandLine, Connection
         handleLogout(handler);
     }
     else if (command == "report") {
-        string file;
-        ss >> file;
-        handleReport(file, handler);
+        vector<string> files;
+        ReportOptions options;
+        string arg;
+        while (ss >> arg) {
+            if (arg == "--batch") {
+                int n = 0;
+                if (!(ss >> n) || n < 1) {
+                    cout << "Error: --batch expects a positive number of events" << endl;
+                    return;
+                }
+                options.batchSize = n;
+            }
+            else if (arg == "--full") {
+                options.full = true;
+            }
+            else if (arg == "--stream") {
+                options.stream = true;
+            }
+            else if (arg == "--ack") {
+                int n = 0;
+                if (!(ss >> n) || n < 1) {
+                    cout << "Error: --ack expects a positive number of frames" << endl;
+                    return;
+                }
+                options.ackEvery = n;
+            }
+            else if (arg == "--pace") {
+                double speed = 0;
+                if (!(ss >> speed) || speed < 1 || speed > 1000) {
+                    cout << "Error: --pace expects a speed between 1 and 1000" << endl;
+                    return;
+                }
+                options.pace = speed;
+            }
+            else
+                files.push_back(arg);
+        }
+        handleReport(files, options, handler);
     }
     else if (command == "summary") {
-        string gameName, user, file;
+        string gameName, user, file, arg;
+        string format = "text";
         ss >> gameName >> user >> file;
-        handleSummary(gameName, user, file);
+        if (ss >> arg && (arg != "--format" || !(ss >> format))) {
+            cout << "Error: usage is 'summary {game_name} {user} {file} [--format text|jsonl|csv|binary]'" << endl;
+            return;
+        }
+        handleSummary(gameName, user, file, format);
+    }
+    else if (command == "query") {
+        string gameName, arg;
+        ss >> gameName;
+        int from = INT_MIN;
+        int to = INT_MAX;
+        string name, user;
+        vector<string> args;
+        while (ss >> arg)
+            args.push_back(arg);
+        auto isOption = [](const string& token) {
+            return token == "--from" || token == "--to" || token == "--name" || token == "--user";
+        };
+        bool valid = !gameName.empty();
+        for (size_t i = 0; valid && i < args.size(); i++) {
+            const string& option = args[i];
+            valid = i + 1 < args.size() && !isOption(args[i + 1]);
+            if (!valid)
+                break;
+            if (option == "--from" || option == "--to") {
+                stringstream number(args[++i]);
+                valid = static_cast<bool>(number >> (option == "--from" ? from : to)) && number.eof();
+            }
+            else if (option == "--name") {
+                // an event name may have spaces, so it runs up to the next option
+                name = args[++i];
+                while (i + 1 < args.size() && !isOption(args[i + 1]))
+                    name += " " + args[++i];
+            }
+            else if (option == "--user")
+                user = args[++i];
+            else
+                valid = false;
+        }
+        if (!valid) {
+            cout << "Error: usage is 'query {game_name} [--from {seconds}] [--to {seconds}] [--name {text}] [--user {username}]'" << endl;
+            return;
+        }
+        handleQuery(gameName, from, to, name, user);
+    }
+    else if (command == "retention") {
+        string arg;
+        while (ss >> arg) {
+            long long n = -1;
+            if (!(ss >> n) || n < 0) {
+                cout << "Error: " << arg << " expects a non-negative number, 0 for unlimited" << endl;
+                return;
+            }
+            if (arg == "--game-events")
+                retention.gameEvents = n;
+            else if (arg == "--game-bytes")
+                retention.gameBytes = n;
+            else if (arg == "--age")
+                retention.maxAge = (int)std::min(n, (long long)INT_MAX);
+            else if (arg == "--total-bytes")
+                retention.totalBytes = n;
+            else {
+                cout << "Error: usage is 'retention [--game-events {n}] [--game-bytes {n}] [--age {seconds}] [--total-bytes {n}]'" << endl;
+                return;
+            }
+        }
+        handleRetention();
+    }
+    else if (command == "purge") {
+        string gameName;
+        ss >> gameName;
+        handlePurge(gameName);
     }
     else {
         cout << "Invalid command!" << endl;
@@ -57,7 +314,7 @@ void StompProtocol::handleJoin(const string& gameName, ConnectionHandler* handle
     int receiptId = receiptIdCounter++;
     
     subscriptions[gameName] = subId;
-    pendingReceipts[receiptId] = "Joined channel " + gameName;
+    pendingReceipts.insert(receiptId, "Joined channel " + gameName);
 
     string frame = "SUBSCRIBE\n"
                    "destination:/" + gameName + "\n"
@@ -68,15 +325,17 @@ void StompProtocol::handleJoin(const string& gameName, ConnectionHandler* handle
 
 void StompProtocol::handleExit(const string& gameName, ConnectionHandler* handler) {
     std::lock_guard<std::mutex> lock(mutex); 
-    if (subscriptions.find(gameName) == subscriptions.end()) {
+    auto subscription = subscriptions.find(gameName);
+    if (subscription == subscriptions.end()) {
         cout << "Error: Not subscribed to " << gameName << endl;
         return;
     }
 
-    int subId = subscriptions[gameName];
+    int subId = subscription->second;
     int receiptId = receiptIdCounter++;
-    pendingReceipts[receiptId] = "Exited channel " + gameName;
-    subscriptions.erase(gameName);
+    pendingReceipts.insert(receiptId, "Exited channel " + gameName);
+    exitReceipts[receiptId] = gameName;
+    subscriptions.erase(subscription);
 
     string frame = "UNSUBSCRIBE\n"
                    "id:" + to_string(subId) + "\n"
@@ -85,52 +344,354 @@ void StompProtocol::handleExit(const string& gameName, ConnectionHandler* handle
 }
 
 void StompProtocol::handleLogout(ConnectionHandler* handler) {
+    // what was received in this session is on disk before the session ends
+    if (eventLog != nullptr)
+        eventLog->flush();
     std::lock_guard<std::mutex> lock(mutex);
     int receiptId = receiptIdCounter++;
-    pendingReceipts[receiptId] = "DISCONNECT";
+    pendingReceipts.insert(receiptId, "DISCONNECT");
 
     string frame = "DISCONNECT\n"
                    "receipt:" + to_string(receiptId) + "\n\n\0";
     sendFrame(handler, frame);
+    // the server closes the connection right after the receipt, the reader may see that first
+    handler->expectClose();
+    std::lock_guard<std::mutex> publishedLock(publishedMutex);
+    publishedEvents.clear();
 }
 
-void StompProtocol::handleReport(const string& file, ConnectionHandler* handler) {
-    names_and_events data;
-    try {
-        data = parseEventsFile(file);
-    } catch (std::exception& e) {
-        cout << "Error: Failed to parse file " << file << endl;
+void StompProtocol::handlePurge(const string& gameName) {
+    if (!releaseGame(gameName)) {
+        cout << "Error: No data found for game " << gameName << endl;
         return;
     }
+    cout << "Purged stored data for " << gameName << endl;
+}
 
-    std::sort(data.events.begin(), data.events.end(), [](const Event& e1, const Event& e2) {
-        bool is_pre_ht_1 = false;
-        const auto& updates1 = e1.get_game_updates();
-        if (updates1.find("before halftime") != updates1.end()) {
-            if (updates1.at("before halftime") == "true") {
-                is_pre_ht_1 = true;
-            }
+// Prints the stored events of a game in a game-time range, optionally only those whose name
+// contains name or that user reported, answered from the game's index
+void StompProtocol::handleQuery(const string& gameName, int from, int to, const string& name, const string& user) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::shared_ptr<GameShard> game = findGame(gameName, false);
+    if (game == nullptr) {
+        cout << "Error: No data found for game " << gameName << endl;
+        return;
+    }
+
+    // format under the game lock, print after releasing it
+    stringstream ss;
+    size_t matched = 0;
+    {
+        std::lock_guard<std::mutex> lock(game->mutex);
+        game->lastUsed = ++useClock;
+        if (game->released) {
+            cout << "Error: No data found for game " << gameName << endl;
+            return;
+        }
+        for (const EventIndex::Hit& hit : game->index.query(from, to, name, user)) {
+            ss << hit.event->get_time() << " - " << hit.event->get_name() << " (" << *hit.user << "):\n"
+               << hit.event->get_description() << "\n\n";
+            matched++;
+        }
+    }
+    cout << ss.str() << matched << " events matched in " << gameName << " ("
+         << elapsedNanos(start) / 1000 << " us)" << endl;
+}
+
+// Applies the current retention policy to every stored game, then prints it with the memory in use
+void StompProtocol::handleRetention() {
+    vector<std::pair<string, std::shared_ptr<GameShard>>> games = enforceRetention();
+
+    cout << "Retention (0 = unlimited): " << retention.gameEvents << " events and " << retention.gameBytes
+         << " bytes per game, " << retention.maxAge << " s of game time, " << retention.totalBytes << " bytes in total" << endl;
+    size_t summaryBytes = 0;
+    size_t indexBytes = 0;
+    size_t arenaBytes = 0;
+    for (auto& pair : games) {
+        std::lock_guard<std::mutex> lock(pair.second->mutex);
+        size_t evicted = 0;
+        for (auto& user : pair.second->users) {
+            evicted += user.second.evicted;
+            for (auto& format : user.second.rendered)
+                summaryBytes += format.second.headText->capacity() + format.second.eventsText->capacity();
         }
+        size_t gameIndexBytes = pair.second->index.memoryUsage();
+        indexBytes += gameIndexBytes;
+        arenaBytes += pair.second->arena->reservedBytes();
+        cout << "  " << pair.first << ": " << pair.second->events << " events, " << pair.second->bytes
+             << " bytes, index " << gameIndexBytes << " bytes, " << evicted << " evicted" << endl;
+    }
+    cout << "Stored events use " << storedBytes << " bytes in " << games.size() << " games, their indexes "
+         << indexBytes << " bytes, arenas " << arenaBytes << " bytes mapped, rendered summaries "
+         << summaryBytes << " bytes" << endl;
+}
+
+void StompProtocol::handleReport(const vector<string>& patterns, const ReportOptions& options, ConnectionHandler* handler) {
+    vector<string> files = expandPaths(patterns);
+    if (files.empty()) {
+        cout << "Error: usage is 'report [--full] [--stream] [--batch {n}] [--pace {speed}] [--ack {k}] {file} [file ...]'" << endl;
+        return;
+    }
+
+    // The report runs as three overlapping stages: a worker pool parses and sorts the files,
+    // a serializer renders their frames in argument order into a bounded queue, and this
+    // thread sends them. Argument order keeps a game spread over several files in order.
+    // With --stream the serializer decodes and orders each file itself in bounded memory.
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ReportStats stats;
 
-        bool is_pre_ht_2 = false;
-        const auto& updates2 = e2.get_game_updates();
-        if (updates2.find("before halftime") != updates2.end()) {
-            if (updates2.at("before halftime") == "true") {
-                is_pre_ht_2 = true;
+    vector<ReportCache::Report> reports(files.size());
+    vector<LoadState> states(files.size(), LOAD_PENDING);
+    std::mutex stateMutex;
+    std::condition_variable stateChanged;
+    std::atomic<size_t> next(0);
+    size_t workerCount = std::min<size_t>(files.size(), std::max(1u, std::thread::hardware_concurrency()));
+    if (options.stream) workerCount = 0;
+    vector<std::thread> workers;
+    for (size_t w = 0; w < workerCount; w++) {
+        workers.push_back(std::thread([&]() {
+            for (size_t i = next++; i < files.size(); i = next++) {
+                bool ok = loadReport(files[i], reports[i], stats);
+                {
+                    std::lock_guard<std::mutex> lock(stateMutex);
+                    states[i] = ok ? LOAD_DONE : LOAD_FAILED;
+                }
+                stateChanged.notify_all();
             }
+        }));
+    }
+
+    BoundedQueue<ReportFrame> frames(REPORT_QUEUE_CAPACITY);
+    std::thread serializer([&]() {
+        for (size_t i = 0; i < files.size(); i++) {
+            if (options.stream) {
+                if (!serializeStream(files[i], options, frames, stats)) break;
+                continue;
+            }
+            LoadState state;
+            bool firstSend = true;
+            {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                stateChanged.wait(lock, [&]() { return states[i] != LOAD_PENDING; });
+                state = states[i];
+            }
+            bool queued = state == LOAD_FAILED ? frames.push(ReportFrame(files[i], ""))
+                                               : serializeReport(files[i], *reports[i], options, frames, stats, firstSend);
+            reports[i].reset();
+            if (!queued) break;
         }
+        frames.close();
+    });
 
-        if (is_pre_ht_1 != is_pre_ht_2) {
-            return is_pre_ht_1; 
+    // With --pace every file is replayed on its own game clock, starting when its first frame goes out.
+    // The last frame of a report asks for a receipt, and with --ack so does every k-th frame. At most
+    // REPORT_MAX_WINDOWS such windows may be unconfirmed at once, and the events of a window only count
+    // as published once its receipt arrives. The sender looks one frame ahead to know which is last.
+    ReportFrame item;
+    ReportFrame following;
+    bool hasFollowing = frames.pop(following);
+    std::chrono::steady_clock::time_point clockStart;
+    int clockBase = 0;
+    std::chrono::steady_clock::time_point lastTarget;
+    vector<long long> jitter;
+    ReportWindow window;
+    size_t sentFrames = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        dropReportWindows();
+        acknowledgedFrames = 0;
+    }
+    while (hasFollowing) {
+        item = std::move(following);
+        hasFollowing = frames.pop(following);
+        if (item.frame.empty()) {
+            cout << "Error: Failed to parse file " << item.file << endl;
+            continue;
         }
-        return e1.get_time() < e2.get_time();
+        if (options.pace > 0) {
+            std::chrono::steady_clock::time_point target;
+            if (item.firstOfFile) {
+                clockStart = std::chrono::steady_clock::now();
+                clockBase = item.gameTime;
+                target = clockStart;
+            } else {
+                target = clockStart + std::chrono::nanoseconds(
+                    (long long)((item.gameTime - clockBase) * 1e9 / options.pace));
+                if (target < lastTarget) target = lastTarget;
+            }
+            lastTarget = target;
+            waitUntil(target);
+            jitter.push_back(elapsedNanos(target));
+        }
+        window.frames++;
+        if (!item.eventHashes.empty()) {
+            vector<size_t>& hashes = window.hashes[item.publishKey];
+            hashes.insert(hashes.end(), item.eventHashes.begin(), item.eventHashes.end());
+        }
+        if ((options.ackEvery > 0 && window.frames == options.ackEvery) || !hasFollowing || following.frame.empty()) {
+            std::unique_lock<std::mutex> lock(mutex);
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + REPORT_ACK_TIMEOUT;
+            while (reportWindows.size() >= REPORT_MAX_WINDOWS && !shouldTerminate &&
+                   receiptArrived.wait_until(lock, deadline) != std::cv_status::timeout) {}
+            if (reportWindows.size() >= REPORT_MAX_WINDOWS && !shouldTerminate) {
+                cout << "Error: No receipt from the broker for " << REPORT_ACK_TIMEOUT.count()
+                     << " seconds, report aborted" << endl;
+                dropReportWindows();
+                frames.close();
+                break;
+            }
+            int receiptId = receiptIdCounter++;
+            pendingReceipts.insert(receiptId, "Report window of " + to_string(window.frames) + " frames");
+            reportWindows.insert(receiptId, std::move(window));
+            item.frame.insert(item.frame.find('\n') + 1, "receipt:" + to_string(receiptId) + "\n");
+            window = ReportWindow();
+        }
+        std::chrono::steady_clock::time_point sendStart = std::chrono::steady_clock::now();
+        sendFrame(handler, item.frame);
+        stats.send += elapsedNanos(sendStart);
+        if (shouldTerminate) {
+            frames.close();
+            break;
+        }
+        sentFrames++;
+    }
+
+    serializer.join();
+    for (std::thread& worker : workers)
+        worker.join();
+
+    cout << "Report timing (ms): parse " << stats.parse / 1000000
+         << ", sort " << stats.sort / 1000000
+         << ", serialize " << stats.serialize / 1000000
+         << ", send " << stats.send / 1000000
+         << ", wall " << elapsedNanos(start) / 1000000 << endl;
+    if (options.ackEvery > 0) {
+        std::unique_lock<std::mutex> lock(mutex);
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + REPORT_ACK_TIMEOUT;
+        while (!reportWindows.empty() && !shouldTerminate &&
+               receiptArrived.wait_until(lock, deadline) != std::cv_status::timeout) {}
+        cout << "Broker confirmed " << acknowledgedFrames << " of " << sentFrames << " frames" << endl;
+        // a receipt that missed the deadline no longer counts, and the events it covers stay unpublished
+        dropReportWindows();
+    }
+    if (stats.skipped > 0)
+        cout << "Skipped " << stats.skipped << " events already published (use --full to resend)" << endl;
+
+    if (!jitter.empty()) {
+        std::sort(jitter.begin(), jitter.end());
+        cout << "Pacing jitter (us): p50 " << jitter[jitter.size() / 2] / 1000
+             << ", p90 " << jitter[jitter.size() * 9 / 10] / 1000
+             << ", p99 " << jitter[jitter.size() * 99 / 100] / 1000
+             << ", max " << jitter.back() / 1000 << endl;
+    }
+}
+
+// Forgets the report windows still awaiting a receipt, along with their pending receipts.
+// Caller holds mutex.
+void StompProtocol::dropReportWindows() {
+    for (int receiptId : reportWindows.ids())
+        pendingReceipts.erase(receiptId);
+    reportWindows.clear();
+}
+
+// Sleeps until shortly before the deadline and spins the rest of the way, sleep_until alone
+// overshoots by the scheduler's wakeup latency
+void StompProtocol::waitUntil(std::chrono::steady_clock::time_point deadline) {
+    const std::chrono::microseconds spinWindow(200);
+    if (deadline - std::chrono::steady_clock::now() > spinWindow)
+        std::this_thread::sleep_until(deadline - spinWindow);
+    while (std::chrono::steady_clock::now() < deadline)
+        std::this_thread::yield();
+}
+
+long long StompProtocol::elapsedNanos(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+bool StompProtocol::loadReport(const string& file, ReportCache::Report& report, ReportStats& stats) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // stamped before parsing, so a file rewritten meanwhile is never cached under its new stamp
+    ReportCache::FileStamp stamp;
+    bool stamped = ReportCache::statFile(file, stamp);
+    if (stamped && (report = reportCache.lookup(file, stamp))) {
+        stats.parse += elapsedNanos(start);
+        return true;
+    }
+
+    std::shared_ptr<names_and_events> data = std::make_shared<names_and_events>();
+    try {
+        *data = parseEventsFile(file);
+    } catch (std::exception& e) {
+        return false;
+    }
+    stats.parse += elapsedNanos(start);
+
+    start = std::chrono::steady_clock::now();
+    std::sort(data->events.begin(), data->events.end(), [](const Event& e1, const Event& e2) {
+        return e1.get_sort_key() < e2.get_sort_key();
     });
+    stats.sort += elapsedNanos(start);
+    report = data;
+    if (stamped) reportCache.store(file, stamp, report);
+    return true;
+}
 
+// Renders the events of a loaded file into SEND frames, batchSize events per frame.
+// A batched body is "batch:{count}" followed by each event body prefixed with "length:{bytes}".
+// Unless options.full is set, events whose content this user already published to the game are
+// left out. Streamed files are not recorded as published, that would keep a hash per event of
+// files of any size. firstSend says whether the next frame opens the file and carries its
+// filename header.
+// Returns false if the queue was closed.
+bool StompProtocol::serializeReport(const string& file, const names_and_events& data, const ReportOptions& options,
+                                    BoundedQueue<ReportFrame>& frames, ReportStats& stats, bool& firstSend) {
     string gameName = data.team_a_name + "_" + data.team_b_name;
-    bool firstSend = true;
-    for (Event& event : data.events) 
+    string publishKey = this->username + "/" + gameName;
+
+    vector<const Event*> events;
+    vector<size_t> hashes;
+    if (options.full) {
+        for (const Event& event : data.events)
+            events.push_back(&event);
+    } else {
+        // hashed before taking the lock receipts wait on, which is held for the lookups only
+        vector<size_t> all;
+        all.reserve(data.events.size());
+        for (const Event& event : data.events)
+            all.push_back(std::hash<string>()(encodeEvent(event)));
+        vector<bool> published(all.size(), false);
+        {
+            std::lock_guard<std::mutex> lock(publishedMutex);
+            auto found = publishedEvents.find(publishKey);
+            if (found != publishedEvents.end())
+                for (size_t i = 0; i < all.size(); i++)
+                    published[i] = found->second.count(all[i]) > 0;
+        }
+        std::unordered_set<size_t> queued;
+        for (size_t i = 0; i < all.size(); i++) {
+            if (published[i] || !queued.insert(all[i]).second) {
+                stats.skipped++;
+                continue;
+            }
+            events.push_back(&data.events[i]);
+            hashes.push_back(all[i]);
+        }
+    }
+
+    for (size_t first = 0; first < events.size(); first += options.batchSize)
     {
-        string body = buildEventBody(event, this->username, gameName);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t last = std::min(first + options.batchSize, events.size());
+        string body = "";
+        if (options.batchSize == 1) {
+            body = buildEventBody(*events[first], this->username, gameName);
+        } else {
+            body = "batch:" + to_string(last - first) + "\n";
+            for (size_t i = first; i < last; i++) {
+                string eventBody = buildEventBody(*events[i], this->username, gameName);
+                body += "length:" + to_string(eventBody.size()) + "\n" + eventBody;
+            }
+        }
         string frame = "";
         if (firstSend)
             frame = "SEND\n"
@@ -140,45 +701,332 @@ void StompProtocol::handleReport(const string& file, ConnectionHandler* handler)
             frame = "SEND\n"
                         "destination:/" + gameName + "\n"
                         "\n" + body + "\n\0";
-        sendFrame(handler, frame);
+        stats.serialize += elapsedNanos(start);
+
+        ReportFrame item(file, frame, events[first]->get_time(), firstSend);
+        if (!options.stream && !options.full) {
+            item.publishKey = publishKey;
+            item.eventHashes.assign(hashes.begin() + first, hashes.begin() + last);
+        }
+        if (!frames.push(std::move(item)))
+            return false;
         firstSend = false;
     }
+    return true;
+}
+
+// Streams a file through an mmap-backed parser into an external sort, then serializes it in
+// chunks, so memory stays bounded by the sort window whatever the size of the file
+bool StompProtocol::serializeStream(const string& file, const ReportOptions& options,
+                                    BoundedQueue<ReportFrame>& frames, ReportStats& stats) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ExternalEventSorter sorter(STREAM_WINDOW_EVENTS);
+    names_and_events chunk;
+    try {
+        chunk = streamEventsFile(file, [&sorter](Event& event) { sorter.add(event); });
+        sorter.finish();
+    } catch (std::exception& e) {
+        return frames.push(ReportFrame(file, ""));
+    }
+    stats.parse += elapsedNanos(start);
+
+    bool firstSend = true;
+    while (true) {
+        // reading back merges run files, which can fail as well; the frames already queued stay
+        try {
+            if (!sorter.next(chunk.events, STREAM_CHUNK_EVENTS))
+                return true;
+        } catch (std::exception& e) {
+            return frames.push(ReportFrame(file, ""));
+        }
+        // events that preceded the team names in the file were parsed without them
+        for (Event& event : chunk.events) {
+            if (event.get_team_a_name().empty() && event.get_team_b_name().empty())
+                event = Event(to_event_string(chunk.team_a_name), to_event_string(chunk.team_b_name), event.get_name(), event.get_time(),
+                              event.get_game_updates(), event.get_team_a_updates(), event.get_team_b_updates(),
+                              event.get_description());
+        }
+        if (!serializeReport(file, chunk, options, frames, stats, firstSend))
+            return false;
+        chunk.events.clear();
+    }
 }
 
 void StompProtocol::saveEvent(string gameName, string user, Event& event) {
-    std::lock_guard<std::mutex> lock(mutex);
-    GameStats& stats = gameUpdates[gameName][user];
-    stats.events.push_back(event);
-
-    std::sort(stats.events.begin(), stats.events.end(), [](const Event& e1, const Event& e2) {
-        bool is_pre_ht_1 = false;
-        const auto& updates1 = e1.get_game_updates();
-        if (updates1.find("before halftime") != updates1.end()) {
-            if (updates1.at("before halftime") == "true") {
-                is_pre_ht_1 = true;
-            }
+    if (eventLog != nullptr)
+        eventLog->appendEvent(gameName, user, event);
+    storeEvent(gameName, user, event);
+}
+
+void StompProtocol::storeEvent(const string& gameName, const string& user, Event& event) {
+    std::shared_ptr<GameShard> game = findGame(gameName, true);
+    {
+        std::lock_guard<std::mutex> lock(game->mutex);
+        // released after findGame handed it out; the event went with the game
+        if (game->released)
+            return;
+        game->lastUsed = ++useClock;
+        auto slot = game->users.find(user);
+        if (slot == game->users.end())
+            slot = game->users.insert(std::make_pair(user, UserGame(game->arena.get()))).first;
+        UserGame& userGame = slot->second;
+        GameStats& stats = userGame.stats;
+        if (stats.events.empty() && userGame.evicted == 0) {
+            userGame.teamA = to_std_string(event.get_team_a_name());
+            userGame.teamB = to_std_string(event.get_team_b_name());
         }
+        size_t index = stats.addEvent(Event(event, ArenaAllocator<char>(game->arena.get())));
+        // measured on the stored copy, which is what eviction subtracts later
+        size_t bytes = stats.events[index].memory_usage();
+        // a rendered summary's head is redone along with the events, so the stats merged below are covered
+        for (auto& format : userGame.rendered)
+            format.second.eventsDirtyFrom = std::min(format.second.eventsDirtyFrom, index);
+        game->index.add(slot->first, stats.events, stats.events[index]);
+        userGame.eventBytes += bytes;
+        game->events++;
+        game->bytes += bytes;
+        storedBytes += bytes;
 
-        bool is_pre_ht_2 = false;
-        const auto& updates2 = e2.get_game_updates();
-        if (updates2.find("before halftime") != updates2.end()) {
-            if (updates2.at("before halftime") == "true") {
-                is_pre_ht_2 = true;
-            }
+        mergeStats(stats.generalStats, event.get_game_updates());
+        mergeStats(stats.teamAStats, event.get_team_a_updates());
+        mergeStats(stats.teamBStats, event.get_team_b_updates());
+        if (!replaying)
+            enforceGameRetention(*game);
+    }
+    if (!replaying && retention.totalBytes > 0 && storedBytes > retention.totalBytes)
+        enforceTotalRetention();
+}
+
+// Applies updates to stats
+void StompProtocol::mergeStats(map<string, string>& stats, const EventUpdates& updates) {
+    for (auto& pair : updates)
+        stats[to_std_string(pair.first)].assign(pair.second.data(), pair.second.size());
+}
+
+// Returns the game's shard, creating it if asked to, or nullptr. Only the index lock is taken here,
+// the shard stays valid for the caller even if the game is released meanwhile.
+std::shared_ptr<StompProtocol::GameShard> StompProtocol::findGame(const string& gameName, bool create) {
+    std::lock_guard<std::mutex> lock(gamesMutex);
+    auto it = gameUpdates.find(gameName);
+    if (it != gameUpdates.end())
+        return it->second;
+    if (!create)
+        return nullptr;
+    std::shared_ptr<GameShard> game = std::make_shared<GameShard>(gameName);
+    gameUpdates[gameName] = game;
+    return game;
+}
+
+// Drops the game's stored data and logs that it was dropped, and forgets which of its events
+// this session published
+bool StompProtocol::releaseGame(const string& gameName) {
+    {
+        std::lock_guard<std::mutex> publishedLock(publishedMutex);
+        publishedEvents.erase(username + "/" + gameName);
+    }
+    if (!dropGame(gameName))
+        return false;
+    if (eventLog != nullptr)
+        eventLog->appendRelease(gameName);
+    return true;
+}
+
+// Drops every user's stats and events for the game in one erase; its arena goes with the
+// last reference to the shard, unmapping the game's events chunk by chunk
+bool StompProtocol::dropGame(const string& gameName) {
+    std::shared_ptr<GameShard> game;
+    {
+        std::lock_guard<std::mutex> lock(gamesMutex);
+        auto it = gameUpdates.find(gameName);
+        if (it == gameUpdates.end())
+            return false;
+        game = it->second;
+        gameUpdates.erase(it);
+    }
+    std::lock_guard<std::mutex> lock(game->mutex);
+    game->released = true;
+    storedBytes -= game->bytes;
+    game->bytes = 0;
+    return true;
+}
+
+// Drops every game's stored data, without logging it
+void StompProtocol::dropAllGames() {
+    unordered_map<string, std::shared_ptr<GameShard>> games;
+    {
+        std::lock_guard<std::mutex> lock(gamesMutex);
+        games.swap(gameUpdates);
+    }
+    for (auto& pair : games) {
+        std::lock_guard<std::mutex> lock(pair.second->mutex);
+        pair.second->released = true;
+        storedBytes -= pair.second->bytes;
+        pair.second->bytes = 0;
+    }
+}
+
+// Applies the retention policy to every stored game, returns the games by name
+vector<std::pair<string, std::shared_ptr<StompProtocol::GameShard>>> StompProtocol::enforceRetention() {
+    vector<std::pair<string, std::shared_ptr<GameShard>>> games;
+    {
+        std::lock_guard<std::mutex> lock(gamesMutex);
+        for (auto& pair : gameUpdates)
+            games.push_back(pair);
+    }
+    std::sort(games.begin(), games.end());
+    for (auto& pair : games) {
+        std::lock_guard<std::mutex> lock(pair.second->mutex);
+        enforceGameRetention(*pair.second);
+    }
+    if (retention.totalBytes > 0 && storedBytes > retention.totalBytes)
+        enforceTotalRetention();
+    return games;
+}
+
+// Applies the per-game limits of the retention policy; must hold the game's lock
+void StompProtocol::enforceGameRetention(GameShard& game) {
+    size_t maxEvents = retention.gameEvents > 0 ? retention.gameEvents.load() : SIZE_MAX;
+    size_t maxBytes = retention.gameBytes > 0 ? retention.gameBytes.load() : SIZE_MAX;
+    int minTime = INT_MIN;
+    if (retention.maxAge > 0) {
+        int newest = INT_MIN;
+        for (auto& pair : game.users)
+            if (!pair.second.stats.events.empty())
+                newest = std::max(newest, pair.second.stats.events.back().get_time());
+        if (newest != INT_MIN)
+            minTime = newest - retention.maxAge;
+    }
+    if (game.events > maxEvents || game.bytes > maxBytes || minTime != INT_MIN)
+        evictOldest(game, maxEvents, maxBytes, minTime);
+}
+
+// Brings the stored bytes under the total limit, evicting from the least recently used games first
+void StompProtocol::enforceTotalRetention() {
+    vector<std::shared_ptr<GameShard>> games;
+    {
+        std::lock_guard<std::mutex> lock(gamesMutex);
+        for (auto& pair : gameUpdates)
+            games.push_back(pair.second);
+    }
+    std::sort(games.begin(), games.end(), [](const std::shared_ptr<GameShard>& a, const std::shared_ptr<GameShard>& b) {
+        return a->lastUsed < b->lastUsed;
+    });
+    for (std::shared_ptr<GameShard>& game : games) {
+        size_t limit = retention.totalBytes;
+        size_t stored = storedBytes;
+        if (limit == 0 || stored <= limit)
+            break;
+        std::lock_guard<std::mutex> lock(game->mutex);
+        size_t excess = stored - limit;
+        evictOldest(*game, SIZE_MAX, game->bytes > excess ? game->bytes - excess : 0, INT_MIN);
+    }
+}
+
+// Evicts the game's oldest events, in sort order across its users, while it holds more than
+// maxEvents events or maxBytes bytes or its oldest event is before minTime; must hold the game's lock
+void StompProtocol::evictOldest(GameShard& game, size_t maxEvents, size_t maxBytes, int minTime) {
+    // a released game's bytes no longer count towards storedBytes
+    if (game.released)
+        return;
+    // pick the victims first so each user's events and rendered text are trimmed once
+    vector<std::pair<UserGame*, size_t>> cursors;
+    for (auto& pair : game.users)
+        cursors.push_back(std::make_pair(&pair.second, (size_t)0));
+    size_t events = game.events;
+    size_t bytes = game.bytes;
+    while (true) {
+        std::pair<UserGame*, size_t>* oldest = nullptr;
+        for (auto& cursor : cursors) {
+            const EventList& userEvents = cursor.first->stats.events;
+            if (cursor.second < userEvents.size() &&
+                (oldest == nullptr || userEvents[cursor.second].get_sort_key() <
+                                      oldest->first->stats.events[oldest->second].get_sort_key()))
+                oldest = &cursor;
         }
+        if (oldest == nullptr)
+            break;
+        const Event& event = oldest->first->stats.events[oldest->second];
+        if (events <= maxEvents && bytes <= maxBytes && event.get_time() >= minTime)
+            break;
+        events--;
+        bytes -= event.memory_usage();
+        oldest->second++;
+    }
+    size_t next = 0;
+    for (auto& pair : game.users)
+        evictFront(game, pair.first, pair.second, cursors[next++].second);
+    compactArena(game);
+}
+
+// Drops the user's first count events and the part of each rendered summary they occupied
+void StompProtocol::evictFront(GameShard& game, const string& user, UserGame& userGame, size_t count) {
+    if (count == 0)
+        return;
+    if (eventLog != nullptr && !replaying)
+        eventLog->appendEvict(game.name, user, count);
+    EventList& events = userGame.stats.events;
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        bytes += events[i].memory_usage();
+        game.index.remove(events, events[i]);
+    }
+    events.erase(events.begin(), events.begin() + count);
+    userGame.eventBytes -= bytes;
+    userGame.evicted += count;
+    game.events -= count;
+    game.bytes -= bytes;
+    storedBytes -= bytes;
 
-        if (is_pre_ht_1 != is_pre_ht_2) {
-            return is_pre_ht_1; 
+    for (auto& format : userGame.rendered) {
+        RenderedSummary& rendered = format.second;
+        // the head holds the eviction count
+        rendered.headDirty = true;
+        if (rendered.eventsDirtyFrom <= count) {
+            rendered.eventsText = std::make_shared<string>();
+            rendered.eventOffsets.clear();
+            rendered.eventsDirtyFrom = 0;
+            continue;
         }
-        return e1.get_time() < e2.get_time();
-    });
+        if (rendered.eventsText.use_count() > 1)
+            rendered.eventsText = std::make_shared<string>(*rendered.eventsText);
+        size_t cut = rendered.eventOffsets[count];
+        rendered.eventsText->erase(0, cut);
+        rendered.eventOffsets.erase(rendered.eventOffsets.begin(), rendered.eventOffsets.begin() + count);
+        for (size_t& offset : rendered.eventOffsets)
+            offset -= cut;
+        rendered.eventsDirtyFrom -= count;
+    }
+}
 
-    for (auto& pair : event.get_game_updates()) 
-        stats.generalStats[pair.first] = pair.second;
-    for (auto& pair : event.get_team_a_updates()) 
-        stats.teamAStats[pair.first] = pair.second;
-    for (auto& pair : event.get_team_b_updates()) 
-        stats.teamBStats[pair.first] = pair.second;
+// Copies the game's events into a fresh arena and rebuilds the index there once most of the
+// current arena is dead, so a game held under a retention limit does not keep the memory of
+// everything it ever evicted. The deques keep their addresses; must hold the game's lock.
+void StompProtocol::compactArena(GameShard& game) {
+    GameArena& arena = *game.arena;
+    if (arena.reservedBytes() < ARENA_COMPACT_BYTES || arena.releasedBytes() * 2 < arena.usedBytes())
+        return;
+    std::unique_ptr<GameArena> fresh(new GameArena());
+    EventIndex index(fresh.get());
+    for (auto& pair : game.users) {
+        EventList events(ArenaAllocator<Event>(fresh.get()));
+        size_t bytes = 0;
+        for (const Event& event : pair.second.stats.events) {
+            events.push_back(Event(event, ArenaAllocator<char>(fresh.get())));
+            bytes += events.back().memory_usage();
+        }
+        // the copies may hold less spare capacity than the events they replace
+        game.bytes = game.bytes - pair.second.eventBytes + bytes;
+        storedBytes -= pair.second.eventBytes;
+        storedBytes += bytes;
+        pair.second.eventBytes = bytes;
+        pair.second.stats.events.swap(events);
+        arena.abandon(events);
+        for (const Event& event : pair.second.stats.events)
+            index.add(pair.first, pair.second.stats.events, event);
+    }
+    game.index.abandon();
+    game.index = std::move(index);
+    game.arena.swap(fresh);
 }
 
 string StompProtocol::buildEventBody(const Event& event, string user, string gameName) {
@@ -201,75 +1049,117 @@ string StompProtocol::buildEventBody(const Event& event, string user, string gam
     return ss.str();
 }
 
-void StompProtocol::handleSummary(const string& gameName, const string& user, const string& file) {
-    std::lock_guard<std::mutex> lock(mutex);
-    if (gameUpdates.find(gameName) == gameUpdates.end() || 
-        gameUpdates[gameName].find(user) == gameUpdates[gameName].end()) {
+void StompProtocol::handleSummary(const string& gameName, const string& user, const string& file, const string& format) {
+    SummaryJob job;
+    job.encoder = makeSummaryEncoder(format);
+    if (job.encoder == nullptr) {
+        cout << "Error: Unknown summary format " << format << ", expected text, jsonl, csv or binary" << endl;
+        return;
+    }
+    std::shared_ptr<GameShard> game = findGame(gameName, false);
+    if (game == nullptr) {
         cout << "Error: No data found for game " << gameName << " user " << user << endl;
         return;
     }
-
-    GameStats& gs = gameUpdates[gameName][user];
-    std::ofstream f(file);
-    if (!f) {
-        cout << "Error: Could not open file " << file << endl;
+    std::unique_lock<std::mutex> lock(game->mutex);
+    auto found = game->users.find(user);
+    if (game->released || found == game->users.end()) {
+        cout << "Error: No data found for game " << gameName << " user " << user << endl;
         return;
     }
 
-    string tA = "Team A";
-    string tB = "Team B";
-    if (gs.events.size() > 0) {
-        tA = gs.events[0].get_team_a_name();
-        tB = gs.events[0].get_team_b_name();
-    }
+    // Only grabbing the snapshot happens under the game lock; ingestion carries on while it is written
+    game->lastUsed = ++useClock;
+    job.data.gameName = gameName;
+    job.data.user = user;
+    takeSummary(found->second, format, *job.encoder, job.data);
+    lock.unlock();
 
-    f << tA << " vs " << tB << "\n";
-    f << "Game stats:\n";
-    f << "General stats:\n";
-    for (auto& p : gs.generalStats) {
-        f << p.first << ": " << p.second << "\n";
+    job.file = file;
+    job.submitted = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> filesLock(summaryFilesMutex);
+        job.turn = summaryFiles[file].next++;
     }
-    f << tA << " stats:\n";
-    for (auto& p : gs.teamAStats) {
-        f << p.first << ": " << p.second << "\n";
+    if (!summaryJobs.push(std::move(job)))
+        finishSummaryTurn(file);
+}
+
+// Summary writer loop, runs until the queue is closed and drained. Jobs are popped in turn
+// order, so a writer only ever waits on a job another writer already holds. Each job is
+// released as soon as it is written, the summary texts it shares are then free to be
+// extended in place again.
+void StompProtocol::writeSummaries() {
+    while (true) {
+        SummaryJob job;
+        if (!summaryJobs.pop(job))
+            return;
+        {
+            std::unique_lock<std::mutex> filesLock(summaryFilesMutex);
+            summaryFileDone.wait(filesLock, [&] { return summaryFiles[job.file].serving == job.turn; });
+        }
+        writeSummary(job);
+        finishSummaryTurn(job.file);
     }
-    f << tB << " stats:\n";
-    for (auto& p : gs.teamBStats) {
-        f << p.first << ": " << p.second << "\n";
+}
+
+// Passes the file on to its next summary, forgetting it once none is left
+void StompProtocol::finishSummaryTurn(const string& file) {
+    std::lock_guard<std::mutex> filesLock(summaryFilesMutex);
+    FileTurns& turns = summaryFiles[file];
+    if (++turns.serving == turns.next)
+        summaryFiles.erase(file);
+    summaryFileDone.notify_all();
+}
+
+void StompProtocol::writeSummary(const SummaryJob& job) {
+    SummaryBuffer out(job.file, SUMMARY_BUFFER_BYTES);
+    if (!out.isOpen()) {
+        cout << "Error: Could not open file " << job.file << endl;
+        return;
     }
-    f << "Game event reports:\n";
-    for (size_t i = 0; i < gs.events.size(); i++) {
-        f << gs.events[i].get_time() << " - " << gs.events[i].get_name() << ":\n\n";
-        f << gs.events[i].get_description() << "\n\n";
+    job.encoder->encode(job.data, out);
+    if (!out.close()) {
+        cout << "Error: Could not write summary to " << job.file << endl;
+        return;
     }
-    f.close();
+    cout << "Summary of " << job.data.gameName << " by " << job.data.user << " written to " << job.file << " ("
+         << out.size() / 1024 << " KB, " << elapsedNanos(job.submitted) / 1000000 << " ms)" << endl;
+}
+
+// Fills the rest of data for the summary of userGame with its parts rendered in format, brought
+// up to date first; must hold the game's lock
+void StompProtocol::takeSummary(UserGame& userGame, const string& format, const SummaryEncoder& encoder, SummaryData& data) {
+    data.teamA = userGame.teamA;
+    data.teamB = userGame.teamB;
+    data.evicted = userGame.evicted;
+    encoder.render(userGame.stats, userGame.rendered[format], data);
 }
 
 // Server Frame Processing
 bool StompProtocol::processServerFrame(const string& frame) {
-    char spliter = '\n';
-    vector<string> result = split(frame, spliter);
-    if (result.size() == 0) return false;
-
-    string command = trim(result[0]);
-    if (command.length() == 0) return true;
+    // Only the command line is read here. MESSAGE bodies are decoded in place by
+    // handleServerMessage, the short control frames are split into lines.
+    size_t eol = frame.find('\n');
+    string command = frame.substr(0, eol);
+    if (command.find_first_not_of(" \r\t") == string::npos) return true;
+    command = trim(command);
+    vector<string> result;
+    if (command != "MESSAGE" && eol != string::npos)
+        result = split(frame.substr(eol + 1), '\n');
 
     std::cout << "Received frame from server:\n" << frame << std::endl;
     if (command == "CONNECTED") {
-        result.erase(result.begin());
         handleServerConnected(result);
     } 
     else if (command == "ERROR") {
-        result.erase(result.begin());
         handleServerError(result);
         return false;
     } 
     else if (command == "MESSAGE") {
-        result.erase(result.begin());
-        handleServerMessage(result);
+        handleServerMessage(frame);
     } 
     else if (command == "RECEIPT") {
-        result.erase(result.begin());
         handleServerReceipt(result);
         if (shouldTerminate) return false; 
     } 
@@ -279,6 +1169,22 @@ bool StompProtocol::processServerFrame(const string& frame) {
     return true;
 }
 
+// Expands shell-style globs, arguments without a match are kept as given
+vector<string> StompProtocol::expandPaths(const vector<string>& patterns) {
+    vector<string> paths;
+    for (const string& pattern : patterns) {
+        glob_t matches;
+        if (glob(pattern.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; i++)
+                paths.push_back(matches.gl_pathv[i]);
+        } else {
+            paths.push_back(pattern);
+        }
+        globfree(&matches);
+    }
+    return paths;
+}
+
 string StompProtocol::trim(const string& str){
     int firstindex = 0;
     bool found = false;
@@ -336,17 +1242,32 @@ void StompProtocol::handleServerConnected(const vector<string>& lines) {
 
 void StompProtocol::handleServerReceipt(const vector<string>& lines) {
     std::lock_guard<std::mutex> lock(mutex);
-    std::regex receiptRegex("receipt-id:\\s*(\\d+)");
+    static const std::regex receiptRegex("receipt-id:\\s*(\\d+)");
     for (const string& line : lines) {
         std::smatch match;
         if (std::regex_search(line, match, receiptRegex)) {
             int receiptId = std::stoi(match[1]);
-            if (pendingReceipts.find(receiptId) != pendingReceipts.end()) {
-                string action = pendingReceipts[receiptId];
+            string action;
+            if (pendingReceipts.take(receiptId, action)) {
                 if (action == "DISCONNECT") {
                     shouldTerminate = true;
+                    receiptArrived.notify_all();
+                }
+            }
+            auto exited = exitReceipts.find(receiptId);
+            if (exited != exitReceipts.end()) {
+                releaseGame(exited->second);
+                exitReceipts.erase(exited);
+            }
+            ReportWindow window;
+            if (reportWindows.take(receiptId, window)) {
+                acknowledgedFrames += window.frames;
+                {
+                    std::lock_guard<std::mutex> publishedLock(publishedMutex);
+                    for (const auto& pair : window.hashes)
+                        publishedEvents[pair.first].insert(pair.second.begin(), pair.second.end());
                 }
-                pendingReceipts.erase(receiptId);
+                receiptArrived.notify_all();
             }
         }
     }
@@ -358,100 +1279,76 @@ void StompProtocol::handleServerError(const vector<string>& lines) {
         errorMsg += "\n" + line;
     }
     cout << errorMsg << endl;
-    shouldTerminate = true;
+    endSession();
 }
 
-void StompProtocol::handleServerMessage(const vector<string>& lines) {
+void StompProtocol::handleServerMessage(const string& frame) {
     string game_name = "";
-    bool in_body = false;
 
-    // Needed parameters for event
-    string user_name = "";
-    string team_a_name = "";
-    string team_b_name = "";
-    string event_name = "";
-    int time_point = 0;
-    string desc = "";
-    std::map<string, string> gen_updates;
-    std::map<string, string> team_a_updates;
-    std::map<string, string> team_b_updates;
-    
-    string section = "";
-    for (const string& raw : lines) {
-        if (!in_body && trim(raw).empty()) {
-            in_body = true;
-            continue;
+    // Headers run until the first blank line, the rest is the event body
+    size_t pos = frame.find('\n');
+    size_t body_start = string::npos;
+    while (pos != string::npos) {
+        size_t eol = frame.find('\n', pos + 1);
+        string h = trim(frame.substr(pos + 1, eol == string::npos ? string::npos : eol - pos - 1));
+        if (h.empty()) {
+            body_start = eol == string::npos ? frame.size() : eol + 1;
+            break;
         }
-
-        if (!in_body) {
-            string h = trim(raw);
-            if (h.find("destination:") == 0) {
-                game_name = trim(h.substr(12));
-                if (!game_name.empty() && game_name[0] == '/') {
-                    game_name = game_name.substr(1);
-                }
-            }
-        } 
-        else {
-            string line_content = raw;
-            if (!line_content.empty() && line_content.back() == '\0') line_content.pop_back();
-            string trimmed_line = trim(line_content);
-
-            if (trimmed_line == "general game updates:") { 
-                section = "general"; 
-                continue; 
-            }
-            else if (trimmed_line == "team a updates:") { 
-                section = "teamA"; 
-                continue; 
-            }
-            else if (trimmed_line == "team b updates:") { 
-                section = "teamB"; 
-                continue; 
-            }
-            else if (trimmed_line == "description:") { 
-                section = "description"; 
-                continue; 
+        if (h.find("destination:") == 0) {
+            game_name = trim(h.substr(12));
+            if (!game_name.empty() && game_name[0] == '/') {
+                game_name = game_name.substr(1);
             }
+        }
+        pos = eol;
+    }
+    if (body_start == string::npos || game_name.empty()) return;
 
-            // Parse content of current section
-            if (section == "") {
-                // Update fields user, time, event name, team a, team b
-                size_t split_idx = line_content.find(':');
-                if (split_idx != string::npos) {
-                    string key_part = trim(line_content.substr(0, split_idx));
-                    string val_part = trim(line_content.substr(split_idx + 1));
-
-                    if (key_part == "user") user_name = val_part;
-                    else if (key_part == "team a") team_a_name = val_part;
-                    else if (key_part == "team b") team_b_name = val_part;
-                    else if (key_part == "event name") event_name = val_part;
-                    else if (key_part == "time") time_point = std::stoi(val_part);
-                }
-            }
-            else if (section == "description") {
-                desc += line_content + "\n";
-            }
-            else {
-                // Update maps of general/teamA/teamB
-                size_t split_idx = line_content.find(':');
-                if (split_idx != string::npos) {
-                    string key_part = trim(line_content.substr(0, split_idx));
-                    string val_part = trim(line_content.substr(split_idx + 1));
-
-                    if (section == "general") gen_updates[key_part] = val_part;
-                    else if (section == "teamA") team_a_updates[key_part] = val_part;
-                    else if (section == "teamB") team_b_updates[key_part] = val_part;
-                }
-            }
+    if (frame.compare(body_start, 6, "batch:") != 0) {
+        string user_name = saveEventBody(game_name, frame, body_start, frame.size() - body_start);
+        if (!user_name.empty())
+            cout << "Received update for " << game_name << " from " << user_name << endl;
+        return;
+    }
+
+    // Batched body: "batch:{count}" then {count} times "length:{bytes}" and the event body
+    size_t count = std::strtoul(frame.c_str() + body_start + 6, nullptr, 10);
+    size_t next = frame.find('\n', body_start);
+    size_t saved = 0;
+    string user_name = "";
+    for (size_t i = 0; i < count && next != string::npos; i++) {
+        next++;
+        if (frame.compare(next, 7, "length:") != 0) break;
+        char* end = nullptr;
+        size_t length = std::strtoul(frame.c_str() + next + 7, &end, 10);
+        size_t start = end - frame.c_str();
+        if (start >= frame.size() || frame[start] != '\n' || length > frame.size() - start - 1) break;
+        string user = saveEventBody(game_name, frame, start + 1, length);
+        if (!user.empty()) {
+            user_name = user;
+            saved++;
         }
+        next = start + length;
     }
+    if (saved > 0)
+        cout << "Received " << saved << " updates for " << game_name << " from " << user_name << endl;
+}
 
-    if (!user_name.empty() && !game_name.empty()) {
-        Event event(team_a_name, team_b_name, event_name, time_point, 
-                    gen_updates, team_a_updates, team_b_updates, 
-                    desc);    
-        saveEvent(game_name, user_name, event);
-        cout << "Received update for " << game_name << " from " << user_name << endl;
+// Stores the event body at frame[offset, offset + length) under the user named in it, returns
+// that user or "" if there was none. The body is read in place, never copied out of the frame.
+string StompProtocol::saveEventBody(const string& gameName, const string& frame, size_t offset, size_t length) {
+    string user_name = "";
+    size_t end = offset + length;
+    size_t user_pos = frame.compare(offset, 5, "user:") == 0 ? offset : frame.find("\nuser:", offset);
+    if (user_pos != string::npos && user_pos < end) {
+        if (frame[user_pos] == '\n') user_pos++;
+        size_t user_end = std::min(frame.find('\n', user_pos), end);
+        user_name = trim(frame.substr(user_pos + 5, user_end - user_pos - 5));
     }
-}
\ No newline at end of file
+    if (user_name.empty()) return user_name;
+
+    Event event(frame, offset, length);
+    saveEvent(gameName, user_name, event);
+    return user_name;
+}
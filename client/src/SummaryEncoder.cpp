@@ -0,0 +1,358 @@
+#include "../include/SummaryEncoder.h"
+#include "../include/EventCodec.h"
+#include <map>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+SummaryBuffer::SummaryBuffer(const std::string &path, size_t capacity)
+    : fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)), buffer(capacity), used(0), written(0),
+      failed(false) {}
+
+SummaryBuffer::~SummaryBuffer()
+{
+    close();
+}
+
+bool SummaryBuffer::isOpen() const
+{
+    return fd >= 0;
+}
+
+void SummaryBuffer::writeOut(const char *data, size_t size)
+{
+    while (size > 0 && !failed)
+    {
+        ssize_t n = write(fd, data, size);
+        if (n < 0)
+            failed = true;
+        else
+        {
+            data += n;
+            size -= n;
+        }
+    }
+}
+
+void SummaryBuffer::append(const char *data, size_t size)
+{
+    written += size;
+    if (used + size > buffer.size())
+    {
+        flush();
+        // a piece larger than the buffer goes straight out instead of in slices
+        if (size >= buffer.size())
+        {
+            writeOut(data, size);
+            return;
+        }
+    }
+    std::memcpy(buffer.data() + used, data, size);
+    used += size;
+}
+
+void SummaryBuffer::append(const std::string &text)
+{
+    append(text.data(), text.size());
+}
+
+void SummaryBuffer::flush()
+{
+    writeOut(buffer.data(), used);
+    used = 0;
+}
+
+bool SummaryBuffer::close()
+{
+    if (fd < 0)
+        return false;
+    flush();
+    failed = ::close(fd) != 0 || failed;
+    fd = -1;
+    return !failed;
+}
+
+size_t SummaryBuffer::size() const
+{
+    return written;
+}
+
+SummaryEncoder::~SummaryEncoder() {}
+
+void SummaryEncoder::render(const GameStats &stats, RenderedSummary &rendered, SummaryData &data) const
+{
+    if (rendered.eventsDirtyFrom < stats.events.size())
+    {
+        // copy on write: a summary still being written keeps the text it was given
+        if (rendered.eventsText.use_count() > 1)
+            rendered.eventsText = std::make_shared<std::string>(*rendered.eventsText);
+        std::string &text = *rendered.eventsText;
+        size_t from = rendered.eventsDirtyFrom;
+        text.resize(from < rendered.eventOffsets.size() ? rendered.eventOffsets[from] : text.size());
+        rendered.eventOffsets.resize(from);
+        for (size_t i = from; i < stats.events.size(); i++)
+        {
+            rendered.eventOffsets.push_back(text.size());
+            renderEvent(data, stats.events[i], rendered.keys, text);
+        }
+        rendered.headDirty = true;
+    }
+    rendered.eventsDirtyFrom = stats.events.size();
+    if (rendered.headDirty)
+    {
+        std::string head;
+        renderHead(data, stats, rendered.keys, head);
+        rendered.headText = std::make_shared<const std::string>(std::move(head));
+        rendered.headDirty = false;
+    }
+    data.headText = rendered.headText;
+    data.eventsText = rendered.eventsText;
+}
+
+void SummaryEncoder::encode(const SummaryData &data, SummaryBuffer &out) const
+{
+    out.append(*data.headText);
+    out.append(*data.eventsText);
+}
+
+namespace
+{
+    // The layout summary has always written
+    class TextSummaryEncoder : public SummaryEncoder
+    {
+    private:
+        static void stats(std::string &text, const std::string &title, const std::map<std::string, std::string> &stats)
+        {
+            text += title;
+            for (const auto &pair : stats)
+            {
+                text += pair.first;
+                text += ": ";
+                text += pair.second;
+                text += '\n';
+            }
+        }
+
+    protected:
+        void renderHead(const SummaryData &data, const GameStats &gs, EventKeyTable &, std::string &text) const
+        {
+            text += data.teamA + " vs " + data.teamB + "\n";
+            text += "Game stats:\n";
+            stats(text, "General stats:\n", gs.generalStats);
+            stats(text, data.teamA + " stats:\n", gs.teamAStats);
+            stats(text, data.teamB + " stats:\n", gs.teamBStats);
+            text += "Game event reports:\n";
+            if (data.evicted > 0)
+                text += "(" + std::to_string(data.evicted) + " earlier event reports evicted)\n\n";
+        }
+
+        void renderEvent(const SummaryData &, const Event &event, EventKeyTable &, std::string &text) const
+        {
+            text += std::to_string(event.get_time());
+            text += " - ";
+            text.append(event.get_name().data(), event.get_name().size());
+            text += ":\n\n";
+            text.append(event.get_description().data(), event.get_description().size());
+            text += "\n\n";
+        }
+    };
+
+    // One JSON object per line: the game with its final stats, then every event in order
+    class JsonLinesSummaryEncoder : public SummaryEncoder
+    {
+    private:
+        template <typename String>
+        static void quoted(std::string &text, const String &value)
+        {
+            text += '"';
+            size_t clean = 0;
+            for (size_t i = 0; i < value.size(); i++)
+            {
+                unsigned char c = value[i];
+                if (c >= 0x20 && c != '"' && c != '\\')
+                    continue;
+                text.append(value.data() + clean, i - clean);
+                clean = i + 1;
+                switch (c)
+                {
+                case '"': text += "\\\""; break;
+                case '\\': text += "\\\\"; break;
+                case '\n': text += "\\n"; break;
+                case '\r': text += "\\r"; break;
+                case '\t': text += "\\t"; break;
+                default:
+                {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    text.append(escaped, 6);
+                }
+                }
+            }
+            text.append(value.data() + clean, value.size() - clean);
+            text += '"';
+        }
+
+        static void field(std::string &text, const char *name, bool first = false)
+        {
+            if (!first)
+                text += ',';
+            text += '"';
+            text += name;
+            text += "\":";
+        }
+
+        template <typename Map>
+        static void object(std::string &text, const Map &updates)
+        {
+            text += '{';
+            bool first = true;
+            for (const auto &pair : updates)
+            {
+                if (!first)
+                    text += ',';
+                first = false;
+                quoted(text, pair.first);
+                text += ':';
+                quoted(text, pair.second);
+            }
+            text += '}';
+        }
+
+    protected:
+        void renderHead(const SummaryData &data, const GameStats &stats, EventKeyTable &, std::string &text) const
+        {
+            text += '{';
+            field(text, "game", true);
+            quoted(text, data.gameName);
+            field(text, "user");
+            quoted(text, data.user);
+            field(text, "team a");
+            quoted(text, data.teamA);
+            field(text, "team b");
+            quoted(text, data.teamB);
+            field(text, "evicted");
+            text += std::to_string(data.evicted);
+            field(text, "general stats");
+            object(text, stats.generalStats);
+            field(text, "team a stats");
+            object(text, stats.teamAStats);
+            field(text, "team b stats");
+            object(text, stats.teamBStats);
+            text += "}\n";
+        }
+
+        void renderEvent(const SummaryData &, const Event &event, EventKeyTable &, std::string &text) const
+        {
+            text += '{';
+            field(text, "time", true);
+            text += std::to_string(event.get_time());
+            field(text, "name");
+            quoted(text, event.get_name());
+            field(text, "general game updates");
+            object(text, event.get_game_updates());
+            field(text, "team a updates");
+            object(text, event.get_team_a_updates());
+            field(text, "team b updates");
+            object(text, event.get_team_b_updates());
+            field(text, "description");
+            quoted(text, event.get_description());
+            text += "}\n";
+        }
+    };
+
+    // One row per event, update maps flattened to key=value;key=value. The final stats are not
+    // repeated, they are the last value of each update key.
+    class CsvSummaryEncoder : public SummaryEncoder
+    {
+    private:
+        template <typename String>
+        static void cell(std::string &text, const String &value)
+        {
+            if (value.find_first_of(",\"\r\n") == String::npos)
+            {
+                text.append(value.data(), value.size());
+                return;
+            }
+            text += '"';
+            size_t clean = 0;
+            for (size_t quote = value.find('"'); quote != String::npos; quote = value.find('"', quote + 1))
+            {
+                text.append(value.data() + clean, quote + 1 - clean);
+                text += '"';
+                clean = quote + 1;
+            }
+            text.append(value.data() + clean, value.size() - clean);
+            text += '"';
+        }
+
+        static void updates(std::string &text, const EventUpdates &updates)
+        {
+            std::string flat;
+            for (const auto &pair : updates)
+            {
+                if (!flat.empty())
+                    flat += ';';
+                flat.append(pair.first.data(), pair.first.size());
+                flat += '=';
+                flat.append(pair.second.data(), pair.second.size());
+            }
+            cell(text, flat);
+        }
+
+    protected:
+        void renderHead(const SummaryData &, const GameStats &, EventKeyTable &, std::string &text) const
+        {
+            text += "game,user,time,name,general game updates,team a updates,team b updates,description\n";
+        }
+
+        void renderEvent(const SummaryData &data, const Event &event, EventKeyTable &, std::string &text) const
+        {
+            cell(text, data.gameName);
+            text += ',';
+            cell(text, data.user);
+            text += ',';
+            text += std::to_string(event.get_time());
+            text += ',';
+            cell(text, event.get_name());
+            text += ',';
+            updates(text, event.get_game_updates());
+            text += ',';
+            updates(text, event.get_team_a_updates());
+            text += ',';
+            updates(text, event.get_team_b_updates());
+            text += ',';
+            cell(text, event.get_description());
+            text += '\n';
+        }
+    };
+
+    // The summary binary encoding, see EventCodec.h: the events are encoded once with the
+    // cached key table, the head with the stats, the table and the event count on every change
+    class BinarySummaryEncoder : public SummaryEncoder
+    {
+    protected:
+        void renderHead(const SummaryData &data, const GameStats &stats, EventKeyTable &keys, std::string &text) const
+        {
+            text = encodeSummaryHead(keys, data.gameName, data.user, data.teamA, data.teamB, data.evicted, stats);
+        }
+
+        void renderEvent(const SummaryData &, const Event &event, EventKeyTable &keys, std::string &text) const
+        {
+            encodeSummaryEvent(keys, event, text);
+        }
+    };
+}
+
+std::unique_ptr<SummaryEncoder> makeSummaryEncoder(const std::string &format)
+{
+    if (format == "text")
+        return std::unique_ptr<SummaryEncoder>(new TextSummaryEncoder());
+    if (format == "jsonl")
+        return std::unique_ptr<SummaryEncoder>(new JsonLinesSummaryEncoder());
+    if (format == "csv")
+        return std::unique_ptr<SummaryEncoder>(new CsvSummaryEncoder());
+    if (format == "binary")
+        return std::unique_ptr<SummaryEncoder>(new BinarySummaryEncoder());
+    return nullptr;
+}
@@ -6,32 +6,57 @@
 #include <map>
 #include <vector>
 #include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <cstring>
+#include <utility>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 using json = nlohmann::json;
 
-Event::Event(std::string team_a_name, std::string team_b_name, std::string name, int time,
-             std::map<std::string, std::string> game_updates, std::map<std::string, std::string> team_a_updates,
-             std::map<std::string, std::string> team_b_updates, std::string discription)
-    : team_a_name(team_a_name), team_b_name(team_b_name), name(name),
-      time(time), game_updates(game_updates), team_a_updates(team_a_updates),
-      team_b_updates(team_b_updates), description(discription)
+Event::Event(EventString team_a_name, EventString team_b_name, EventString name, int time,
+             EventUpdates game_updates, EventUpdates team_a_updates, EventUpdates team_b_updates,
+             EventString discription)
+    : team_a_name(std::move(team_a_name)), team_b_name(std::move(team_b_name)), name(std::move(name)),
+      time(time), game_updates(std::move(game_updates)), team_a_updates(std::move(team_a_updates)),
+      team_b_updates(std::move(team_b_updates)), description(std::move(discription)), sort_key(0)
 {
+    compute_sort_key();
+}
+
+Event::Event(const Event &other, const ArenaAllocator<char> &allocator)
+    : team_a_name(other.team_a_name, allocator), team_b_name(other.team_b_name, allocator),
+      name(other.name, allocator), time(other.time), game_updates(allocator), team_a_updates(allocator),
+      team_b_updates(allocator), description(other.description, allocator), sort_key(other.sort_key)
+{
+    // element by element, so the keys and values land in the arena along with the nodes
+    const EventUpdates *from[] = {&other.game_updates, &other.team_a_updates, &other.team_b_updates};
+    EventUpdates *to[] = {&game_updates, &team_a_updates, &team_b_updates};
+    for (int i = 0; i < 3; i++)
+        for (const auto &pair : *from[i])
+            to[i]->emplace_hint(to[i]->end(), EventString(pair.first, allocator), EventString(pair.second, allocator));
 }
 
 Event::~Event()
 {
 }
 
-const std::string &Event::get_team_a_name() const
+const EventString &Event::get_team_a_name() const
 {
     return this->team_a_name;
 }
 
-const std::string &Event::get_team_b_name() const
+const EventString &Event::get_team_b_name() const
 {
     return this->team_b_name;
 }
 
-const std::string &Event::get_name() const
+const EventString &Event::get_name() const
 {
     return this->name;
 }
@@ -41,75 +66,741 @@ int Event::get_time() const
     return this->time;
 }
 
-const std::map<std::string, std::string> &Event::get_game_updates() const
+const EventUpdates &Event::get_game_updates() const
 {
     return this->game_updates;
 }
 
-const std::map<std::string, std::string> &Event::get_team_a_updates() const
+const EventUpdates &Event::get_team_a_updates() const
 {
     return this->team_a_updates;
 }
 
-const std::map<std::string, std::string> &Event::get_team_b_updates() const
+const EventUpdates &Event::get_team_b_updates() const
 {
     return this->team_b_updates;
 }
 
-const std::string &Event::get_description() const
+const EventString &Event::get_description() const
 {
     return this->description;
 }
 
-Event::Event(const std::string &frame_body) : team_a_name(""), team_b_name(""), name(""), time(0), game_updates(), team_a_updates(), team_b_updates(), description("")
+uint64_t Event::get_sort_key() const
 {
+    return this->sort_key;
 }
 
-names_and_events parseEventsFile(std::string json_path)
+size_t Event::memory_usage() const
+{
+    // a map node holds its key and value plus the tree links, roughly four pointers
+    const size_t node = 4 * sizeof(void *) + 2 * sizeof(EventString);
+    size_t bytes = sizeof(Event) + team_a_name.capacity() + team_b_name.capacity() + name.capacity() +
+                   description.capacity();
+    for (const EventUpdates *updates : {&game_updates, &team_a_updates, &team_b_updates})
+        for (const auto &pair : *updates)
+            bytes += node + pair.first.capacity() + pair.second.capacity();
+    return bytes;
+}
+
+size_t GameStats::addEvent(Event event)
 {
-    std::ifstream f(json_path);
-    json data = json::parse(f);
+    if (events.empty() || events.back().get_sort_key() <= event.get_sort_key())
+    {
+        events.push_back(std::move(event));
+        return events.size() - 1;
+    }
+    auto position = std::upper_bound(events.begin(), events.end(), event.get_sort_key(),
+                                     [](uint64_t key, const Event &other) { return key < other.get_sort_key(); });
+    size_t index = position - events.begin();
+    events.insert(position, std::move(event));
+    return index;
+}
 
-    std::string team_a_name = data["team a"];
-    std::string team_b_name = data["team b"];
+// Periods: 1 first half, 2 second half, 3-4 extra time, 5 penalties.
+// An explicit "period" update wins, otherwise "before halftime" decides between the two halves.
+// The time is stored with a bias so negative times keep their order. The arrival sequence is a
+// process-wide 32-bit counter: only events of the same period and second need it, and it takes
+// 4.29 billion constructed events before it wraps and could order such a pair backwards.
+void Event::compute_sort_key()
+{
+    static std::atomic<uint32_t> arrival(0);
+    const int64_t time_bias = 1 << 27;
+    const int64_t time_max = (1 << 28) - 1;
 
-    // run over all the events and convert them to Event objects
-    std::vector<Event> events;
-    for (auto &event : data["events"])
+    uint64_t period = 2;
+    auto it = game_updates.find("period");
+    if (it != game_updates.end())
     {
-        std::string name = event["event name"];
-        int time = event["time"];
-        std::string description = event["description"];
-        std::map<std::string, std::string> game_updates;
-        std::map<std::string, std::string> team_a_updates;
-        std::map<std::string, std::string> team_b_updates;
-        for (auto &update : event["general game updates"].items())
+        try
         {
-            if (update.value().is_string())
-                game_updates[update.key()] = update.value();
-            else
-                game_updates[update.key()] = update.value().dump();
+            int p = std::stoi(to_std_string(it->second));
+            period = p < 0 ? 0 : (p > 0xF ? 0xF : p);
+        }
+        catch (std::exception &e)
+        {
+        }
+    }
+    else
+    {
+        it = game_updates.find("before halftime");
+        if (it != game_updates.end() && it->second == "true")
+            period = 1;
+    }
+
+    uint64_t t = (uint64_t)std::min(std::max((int64_t)time + time_bias, (int64_t)0), time_max);
+    uint64_t seq = arrival++;
+    sort_key = (period << 60) | (t << 32) | seq;
+}
+
+// Decodes the body built by StompProtocol::buildEventBody in a single pass, writing straight into the members.
+// The body is the length bytes of frame_body from offset on, so it is read in place inside a frame.
+// The "user" line is not part of the event and is skipped.
+Event::Event(const std::string &frame_body, size_t offset, size_t length) : team_a_name(""), team_b_name(""), name(""), time(0), game_updates(), team_a_updates(), team_b_updates(), description(""), sort_key(0)
+{
+    enum Section { FIELDS, GENERAL, TEAM_A, TEAM_B, DESCRIPTION };
+    Section section = FIELDS;
+
+    const size_t end = offset + std::min(length, frame_body.size() - std::min(offset, frame_body.size()));
+    size_t pos = offset;
+    while (pos < end)
+    {
+        if (section == DESCRIPTION)
+        {
+            size_t last = frame_body.find_last_not_of(std::string("\r\n\0", 3), end - 1);
+            if (last != std::string::npos && last >= pos)
+                description.assign(frame_body.data() + pos, last + 1 - pos);
+            break;
+        }
+
+        size_t eol = frame_body.find('\n', pos);
+        if (eol == std::string::npos || eol > end)
+            eol = end;
+        size_t first = frame_body.find_first_not_of(" \t\r", pos);
+        size_t last = frame_body.find_last_not_of(" \t\r", eol - 1);
+        size_t next = eol + 1;
+        if (first >= eol || last == std::string::npos || last < first)
+        {
+            pos = next;
+            continue;
+        }
+        size_t line_length = last + 1 - first;
+
+        if (frame_body.compare(first, line_length, "general game updates:") == 0)
+            section = GENERAL;
+        else if (frame_body.compare(first, line_length, "team a updates:") == 0)
+            section = TEAM_A;
+        else if (frame_body.compare(first, line_length, "team b updates:") == 0)
+            section = TEAM_B;
+        else if (frame_body.compare(first, line_length, "description:") == 0)
+            section = DESCRIPTION;
+        else
+        {
+            size_t colon = frame_body.find(':', first);
+            if (colon < last + 1)
+            {
+                size_t key_length = 0;
+                if (colon > first)
+                    key_length = frame_body.find_last_not_of(" \t", colon - 1) + 1 - first;
+                size_t value_first = frame_body.find_first_not_of(" \t", colon + 1);
+                size_t value_length = 0;
+                if (value_first <= last)
+                    value_length = last + 1 - value_first;
+                else
+                    value_first = colon + 1;
+
+                if (section == FIELDS)
+                {
+                    if (frame_body.compare(first, key_length, "team a") == 0)
+                        team_a_name.assign(frame_body.data() + value_first, value_length);
+                    else if (frame_body.compare(first, key_length, "team b") == 0)
+                        team_b_name.assign(frame_body.data() + value_first, value_length);
+                    else if (frame_body.compare(first, key_length, "event name") == 0)
+                        name.assign(frame_body.data() + value_first, value_length);
+                    else if (frame_body.compare(first, key_length, "time") == 0)
+                        time = std::atoi(frame_body.c_str() + value_first);
+                }
+                else
+                {
+                    EventUpdates &updates =
+                        section == GENERAL ? game_updates : (section == TEAM_A ? team_a_updates : team_b_updates);
+                    updates[EventString(frame_body.data() + first, key_length)].assign(frame_body.data() + value_first, value_length);
+                }
+            }
+        }
+        pos = next;
+    }
+
+    compute_sort_key();
+}
+
+// SAX handler that builds Events while the events file is being tokenized, the document itself is never materialized.
+// Update values that are not strings are stored the way json::dump() renders them.
+class EventsSaxHandler : public nlohmann::json_sax<json>
+{
+private:
+    enum Context { TOP, EVENTS, EVENT, UPDATES };
+
+    std::vector<Context> contexts;
+    std::string current_key;
+    int skip_depth;
+
+    // nested containers inside an update value, each with the key it has in its parent
+    std::vector<std::pair<json, std::string>> nested;
+    std::string nested_key;
+
+    bool has_team_a;
+    bool has_team_b;
+    bool has_name;
+    bool has_time;
+    bool has_description;
+    EventString name;
+    int time;
+    EventString description;
+    EventUpdates game_updates;
+    EventUpdates team_a_updates;
+    EventUpdates team_b_updates;
+    EventUpdates *updates;
+    bool events_before_names;
+    // receives each finished event instead of result.events when set
+    std::function<void(Event &)> sink;
+
+    void fail(const std::string &what)
+    {
+        throw std::runtime_error("events file: " + what);
+    }
+
+    void addNested(json value)
+    {
+        json &parent = nested.back().first;
+        if (parent.is_object())
+            parent[nested_key] = std::move(value);
+        else
+            parent.push_back(std::move(value));
+    }
+
+    bool onString(std::string &val)
+    {
+        if (!nested.empty())
+        {
+            addNested(json(val));
+            return true;
+        }
+        if (skip_depth > 0 || contexts.empty())
+            return true;
+
+        switch (contexts.back())
+        {
+        case TOP:
+            if (current_key == "team a")
+            {
+                result.team_a_name = val;
+                has_team_a = true;
+            }
+            else if (current_key == "team b")
+            {
+                result.team_b_name = val;
+                has_team_b = true;
+            }
+            break;
+        case EVENTS:
+            fail("event is not an object");
+            break;
+        case EVENT:
+            if (current_key == "event name")
+            {
+                name.assign(val.data(), val.size());
+                has_name = true;
+            }
+            else if (current_key == "description")
+            {
+                description.assign(val.data(), val.size());
+                has_description = true;
+            }
+            else if (current_key == "time")
+                fail("time is not a number");
+            break;
+        case UPDATES:
+            (*updates)[to_event_string(current_key)].assign(val.data(), val.size());
+            break;
+        }
+        return true;
+    }
+
+    bool onValue(json value)
+    {
+        if (!nested.empty())
+        {
+            addNested(std::move(value));
+            return true;
+        }
+        if (skip_depth > 0 || contexts.empty())
+            return true;
+
+        switch (contexts.back())
+        {
+        case TOP:
+            if (current_key == "team a" || current_key == "team b")
+                fail(current_key + " is not a string");
+            break;
+        case EVENTS:
+            fail("event is not an object");
+            break;
+        case EVENT:
+            if (current_key == "time")
+            {
+                time = value.get<int>();
+                has_time = true;
+            }
+            else if (current_key == "event name" || current_key == "description")
+                fail(current_key + " is not a string");
+            break;
+        case UPDATES:
+            (*updates)[to_event_string(current_key)] = to_event_string(value.dump());
+            break;
+        }
+        return true;
+    }
+
+    bool onStart(json container)
+    {
+        if (!nested.empty())
+        {
+            nested.push_back(std::make_pair(std::move(container), nested_key));
+            return true;
+        }
+        if (skip_depth > 0)
+        {
+            skip_depth++;
+            return true;
+        }
+        if (contexts.empty())
+        {
+            if (!container.is_object())
+                fail("top level is not an object");
+            contexts.push_back(TOP);
+            return true;
         }
 
-        for (auto &update : event["team a updates"].items())
+        Context context = contexts.back();
+        if (context == TOP && current_key == "events" && container.is_array())
+            contexts.push_back(EVENTS);
+        else if (context == EVENTS)
+        {
+            if (!container.is_object())
+                fail("event is not an object");
+            has_name = has_time = has_description = false;
+            game_updates.clear();
+            team_a_updates.clear();
+            team_b_updates.clear();
+            contexts.push_back(EVENT);
+        }
+        else if (context == EVENT && current_key == "general game updates" && container.is_object())
+        {
+            updates = &game_updates;
+            contexts.push_back(UPDATES);
+        }
+        else if (context == EVENT && current_key == "team a updates" && container.is_object())
+        {
+            updates = &team_a_updates;
+            contexts.push_back(UPDATES);
+        }
+        else if (context == EVENT && current_key == "team b updates" && container.is_object())
+        {
+            updates = &team_b_updates;
+            contexts.push_back(UPDATES);
+        }
+        else if (context == UPDATES)
+            nested.push_back(std::make_pair(std::move(container), current_key));
+        else
+            skip_depth++;
+        return true;
+    }
+
+    bool onEnd()
+    {
+        if (!nested.empty())
         {
-            if (update.value().is_string())
-                team_a_updates[update.key()] = update.value();
+            std::pair<json, std::string> done = std::move(nested.back());
+            nested.pop_back();
+            if (nested.empty())
+                (*updates)[to_event_string(done.second)] = to_event_string(done.first.dump());
             else
-                team_a_updates[update.key()] = update.value().dump();
+            {
+                nested_key = done.second;
+                addNested(std::move(done.first));
+            }
+            return true;
+        }
+        if (skip_depth > 0)
+        {
+            skip_depth--;
+            return true;
         }
 
-        for (auto &update : event["team b updates"].items())
+        Context context = contexts.back();
+        contexts.pop_back();
+        if (context == EVENT)
         {
-            if (update.value().is_string())
-                team_b_updates[update.key()] = update.value();
+            if (!has_name || !has_time || !has_description)
+                fail("event is missing a name, time or description");
+            if (!has_team_a || !has_team_b)
+                events_before_names = true;
+            Event event(to_event_string(result.team_a_name), to_event_string(result.team_b_name), std::move(name), time,
+                        std::move(game_updates), std::move(team_a_updates),
+                        std::move(team_b_updates), std::move(description));
+            if (sink)
+                sink(event);
             else
-                team_b_updates[update.key()] = update.value().dump();
+                result.events.push_back(std::move(event));
+        }
+        return true;
+    }
+
+public:
+    names_and_events result;
+
+    explicit EventsSaxHandler(std::function<void(Event &)> sink = nullptr)
+        : contexts(), current_key(), skip_depth(0), nested(), nested_key(),
+          has_team_a(false), has_team_b(false), has_name(false), has_time(false), has_description(false),
+          name(), time(0), description(), game_updates(), team_a_updates(), team_b_updates(),
+          updates(nullptr), events_before_names(false), sink(sink), result()
+    {
+    }
+
+    EventsSaxHandler(const EventsSaxHandler &) = delete;
+    EventsSaxHandler &operator=(const EventsSaxHandler &) = delete;
+
+    bool null() override { return onValue(json(nullptr)); }
+    bool boolean(bool val) override { return onValue(json(val)); }
+    bool number_integer(number_integer_t val) override { return onValue(json(val)); }
+    bool number_unsigned(number_unsigned_t val) override { return onValue(json(val)); }
+    bool number_float(number_float_t val, const string_t &) override { return onValue(json(val)); }
+    bool string(string_t &val) override { return onString(val); }
+    bool binary(binary_t &) override { return onValue(json()); }
+    bool start_object(std::size_t) override { return onStart(json::object()); }
+    bool start_array(std::size_t) override { return onStart(json::array()); }
+    bool end_object() override { return onEnd(); }
+    bool end_array() override { return onEnd(); }
+
+    bool key(string_t &val) override
+    {
+        if (!nested.empty())
+            nested_key = val;
+        else if (skip_depth == 0)
+            current_key.swap(val);
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &ex) override
+    {
+        throw std::runtime_error(ex.what());
+    }
+
+    // validates the top level fields, events seen before the team names are rebuilt with them
+    void finish()
+    {
+        if (!has_team_a || !has_team_b)
+            fail("missing team names");
+        if (!events_before_names)
+            return;
+        for (Event &event : result.events)
+            event = Event(to_event_string(result.team_a_name), to_event_string(result.team_b_name), event.get_name(), event.get_time(),
+                          event.get_game_updates(), event.get_team_a_updates(), event.get_team_b_updates(),
+                          event.get_description());
+    }
+};
+
+// Hand-written scanner for exactly the events file schema. It never throws: anything outside the schema
+// (unknown keys, nested or floating point update values, \u escapes, missing fields) makes scan()
+// return false so the caller can fall back to the generic nlohmann parser, which also produces the errors.
+class EventsFileScanner
+{
+private:
+    const char *pos;
+    const char *end;
+
+
+    void skipSpace()
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t'))
+            pos++;
+    }
+
+    bool consume(char c)
+    {
+        skipSpace();
+        if (pos >= end || *pos != c)
+            return false;
+        pos++;
+        return true;
+    }
+
+    bool peek(char c)
+    {
+        skipSpace();
+        return pos < end && *pos == c;
+    }
+
+    template <typename String>
+    bool readString(String &out)
+    {
+        if (!consume('"'))
+            return false;
+        out.clear();
+        const char *start = pos;
+        while (pos < end)
+        {
+            char c = *pos;
+            if (c == '"')
+            {
+                out.append(start, pos - start);
+                pos++;
+                return true;
+            }
+            if ((unsigned char)c < 0x20)
+                return false;
+            if (c != '\\')
+            {
+                pos++;
+                continue;
+            }
+            out.append(start, pos - start);
+            if (++pos >= end)
+                return false;
+            switch (*pos)
+            {
+            case '"': out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/': out.push_back('/'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            default: return false;
+            }
+            start = ++pos;
+        }
+        return false;
+    }
+
+    bool readLiteral(const char *literal, EventString &out)
+    {
+        size_t length = std::strlen(literal);
+        if ((size_t)(end - pos) < length || std::strncmp(pos, literal, length) != 0)
+            return false;
+        out.assign(pos, length);
+        pos += length;
+        return true;
+    }
+
+    // plain integers only, their text is already what json::dump() would print
+    bool readInteger(EventString &out, size_t maxDigits)
+    {
+        const char *start = pos;
+        if (pos < end && *pos == '-')
+            pos++;
+        const char *digits = pos;
+        while (pos < end && *pos >= '0' && *pos <= '9')
+            pos++;
+        size_t count = pos - digits;
+        if (count == 0 || count > maxDigits || (count > 1 && *digits == '0') || (*start == '-' && *digits == '0'))
+            return false;
+        if (pos < end && (*pos == '.' || *pos == 'e' || *pos == 'E'))
+            return false;
+        out.assign(start, pos - start);
+        return true;
+    }
+
+    bool readValue(EventString &out)
+    {
+        skipSpace();
+        if (pos >= end)
+            return false;
+        switch (*pos)
+        {
+        case '"': return readString(out);
+        case 't': return readLiteral("true", out);
+        case 'f': return readLiteral("false", out);
+        case 'n': return readLiteral("null", out);
+        default: return readInteger(out, 18);
+        }
+    }
+
+    bool readUpdates(EventUpdates &updates)
+    {
+        if (!consume('{'))
+            return false;
+        if (consume('}'))
+            return true;
+        EventString key;
+        do
+        {
+            if (!readString(key) || !consume(':') || !readValue(updates[key]))
+                return false;
+        } while (consume(','));
+        return consume('}');
+    }
+
+    bool readEvent(const std::string &team_a_name, const std::string &team_b_name, std::vector<Event> &events)
+    {
+        if (!consume('{'))
+            return false;
+        bool has_name = false, has_time = false, has_description = false;
+        EventString name, description, time_text;
+        std::string key;
+        EventUpdates game_updates, team_a_updates, team_b_updates;
+        if (!peek('}'))
+        {
+            do
+            {
+                if (!readString(key) || !consume(':'))
+                    return false;
+                bool ok;
+                if (key == "event name")
+                    ok = has_name = readString(name);
+                else if (key == "description")
+                    ok = has_description = readString(description);
+                else if (key == "time")
+                {
+                    skipSpace();
+                    ok = has_time = readInteger(time_text, 9);
+                }
+                else if (key == "general game updates")
+                    ok = readUpdates(game_updates);
+                else if (key == "team a updates")
+                    ok = readUpdates(team_a_updates);
+                else if (key == "team b updates")
+                    ok = readUpdates(team_b_updates);
+                else
+                    ok = false;
+                if (!ok)
+                    return false;
+            } while (consume(','));
         }
-        
-        events.push_back(Event(team_a_name, team_b_name, name, time, game_updates, team_a_updates, team_b_updates, description));
+        if (!consume('}') || !has_name || !has_time || !has_description)
+            return false;
+        events.push_back(Event(to_event_string(team_a_name), to_event_string(team_b_name), std::move(name), std::atoi(time_text.c_str()),
+                               std::move(game_updates), std::move(team_a_updates), std::move(team_b_updates),
+                               std::move(description)));
+        return true;
+    }
+
+public:
+    EventsFileScanner(const std::string &buffer) : pos(buffer.data()), end(buffer.data() + buffer.size()) {}
+
+    EventsFileScanner(const EventsFileScanner &) = delete;
+    EventsFileScanner &operator=(const EventsFileScanner &) = delete;
+
+    bool scan(names_and_events &result)
+    {
+        if (!consume('{'))
+            return false;
+        bool has_team_a = false, has_team_b = false, events_before_names = false;
+        std::string key;
+        do
+        {
+            if (!readString(key) || !consume(':'))
+                return false;
+            if (key == "team a")
+            {
+                if (!readString(result.team_a_name))
+                    return false;
+                has_team_a = true;
+            }
+            else if (key == "team b")
+            {
+                if (!readString(result.team_b_name))
+                    return false;
+                has_team_b = true;
+            }
+            else if (key == "events")
+            {
+                if (!consume('['))
+                    return false;
+                events_before_names = events_before_names || !has_team_a || !has_team_b;
+                if (!consume(']'))
+                {
+                    do
+                    {
+                        if (!readEvent(result.team_a_name, result.team_b_name, result.events))
+                            return false;
+                    } while (consume(','));
+                    if (!consume(']'))
+                        return false;
+                }
+            }
+            else
+                return false;
+        } while (consume(','));
+        if (!consume('}') || !has_team_a || !has_team_b)
+            return false;
+        skipSpace();
+        if (pos != end)
+            return false;
+
+        if (events_before_names)
+            for (Event &event : result.events)
+                event = Event(to_event_string(result.team_a_name), to_event_string(result.team_b_name), event.get_name(), event.get_time(),
+                              event.get_game_updates(), event.get_team_a_updates(), event.get_team_b_updates(),
+                              event.get_description());
+        return true;
+    }
+};
+
+names_and_events parseEventsFile(std::string json_path)
+{
+    std::ifstream f(json_path, std::ios::binary);
+    std::string buffer;
+    if (f.seekg(0, std::ios::end))
+    {
+        buffer.resize((size_t)f.tellg());
+        f.seekg(0, std::ios::beg);
+        f.read(&buffer[0], buffer.size());
+        buffer.resize((size_t)f.gcount());
+    }
+
+    names_and_events result;
+    EventsFileScanner scanner(buffer);
+    if (scanner.scan(result))
+        return result;
+
+    EventsSaxHandler handler;
+    json::sax_parse(buffer, &handler);
+    handler.finish();
+    return std::move(handler.result);
+}
+
+names_and_events streamEventsFile(const std::string &json_path, const std::function<void(Event &)> &on_event)
+{
+    int fd = open(json_path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("events file: cannot open " + json_path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        throw std::runtime_error("events file: cannot read " + json_path);
     }
-    names_and_events events_and_names{team_a_name, team_b_name, events};
+    void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("events file: cannot map " + json_path);
+    madvise(mapped, st.st_size, MADV_SEQUENTIAL);
 
-    return events_and_names;
-}
\ No newline at end of file
+    const char *begin = static_cast<const char *>(mapped);
+    EventsSaxHandler handler(on_event);
+    try
+    {
+        json::sax_parse(begin, begin + st.st_size, &handler);
+        handler.finish();
+    }
+    catch (...)
+    {
+        munmap(mapped, st.st_size);
+        throw;
+    }
+    munmap(mapped, st.st_size);
+    return std::move(handler.result);
+}
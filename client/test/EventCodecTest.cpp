@@ -0,0 +1,264 @@
+// Round-trip and malformed input tests for the binary event encoding, run by "make test".
+// Usage: EventCodecTest {events file}
+#include "../include/EventCodec.h"
+#include "../include/event.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <climits>
+#include <stdexcept>
+
+namespace
+{
+    int checks = 0;
+    int failures = 0;
+
+    void check(bool ok, const std::string &what)
+    {
+        checks++;
+        if (!ok)
+        {
+            failures++;
+            std::cout << "FAIL: " << what << std::endl;
+        }
+    }
+
+    bool sameEvent(const Event &a, const Event &b)
+    {
+        return a.get_team_a_name() == b.get_team_a_name() && a.get_team_b_name() == b.get_team_b_name() &&
+               a.get_name() == b.get_name() && a.get_time() == b.get_time() &&
+               a.get_game_updates() == b.get_game_updates() && a.get_team_a_updates() == b.get_team_a_updates() &&
+               a.get_team_b_updates() == b.get_team_b_updates() && a.get_description() == b.get_description();
+    }
+
+    bool sameEvents(const std::vector<Event> &a, const EventList &b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0; i < a.size(); i++)
+            if (!sameEvent(a[i], b[i]))
+                return false;
+        return true;
+    }
+
+    Event makeEvent(const EventString &name, int time, const EventUpdates &game_updates, const EventString &description)
+    {
+        return Event("Team A", "Team B", name, time, game_updates, EventUpdates(), EventUpdates(), description);
+    }
+
+    // decoding must throw std::runtime_error, anything else or nothing fails the check
+    template <typename Decode>
+    void checkRejected(const std::string &buffer, Decode decode, const std::string &what)
+    {
+        try
+        {
+            decode(buffer);
+            check(false, what + " was accepted");
+        }
+        catch (const std::runtime_error &)
+        {
+            check(true, what);
+        }
+        catch (...)
+        {
+            check(false, what + " threw something other than std::runtime_error");
+        }
+    }
+
+    void testEventsFile(const std::string &path)
+    {
+        names_and_events report = parseEventsFile(path);
+        check(!report.events.empty(), path + " has events");
+
+        for (size_t i = 0; i < report.events.size(); i++)
+        {
+            const Event &event = report.events[i];
+            check(sameEvent(decodeEvent(encodeEvent(event)), event), "event " + std::to_string(i) + " of " + path);
+        }
+
+        names_and_events decoded = decodeReport(encodeReport(report));
+        check(decoded.team_a_name == report.team_a_name && decoded.team_b_name == report.team_b_name,
+              "team names of " + path);
+        bool same = decoded.events.size() == report.events.size();
+        for (size_t i = 0; same && i < report.events.size(); i++)
+            same = sameEvent(decoded.events[i], report.events[i]);
+        check(same, "report of " + path);
+
+        // the game stats of a user who received the whole file, events held in an arena
+        GameArena arena;
+        GameStats stats{ArenaAllocator<Event>(&arena)};
+        std::vector<Event> expected;
+        for (const Event &event : report.events)
+        {
+            expected.push_back(event);
+            stats.addEvent(Event(event, ArenaAllocator<char>(&arena)));
+            for (const auto &pair : event.get_game_updates())
+                stats.generalStats[to_std_string(pair.first)] = to_std_string(pair.second);
+            for (const auto &pair : event.get_team_a_updates())
+                stats.teamAStats[to_std_string(pair.first)] = to_std_string(pair.second);
+            for (const auto &pair : event.get_team_b_updates())
+                stats.teamBStats[to_std_string(pair.first)] = to_std_string(pair.second);
+        }
+        GameStats decodedStats = decodeGameStats(encodeGameStats(stats));
+        check(decodedStats.generalStats == stats.generalStats && decodedStats.teamAStats == stats.teamAStats &&
+                  decodedStats.teamBStats == stats.teamBStats,
+              "game stats maps of " + path);
+        std::vector<Event> ordered;
+        for (const Event &event : stats.events)
+            ordered.push_back(event);
+        check(sameEvents(ordered, decodedStats.events), "game stats events of " + path);
+
+        // a summary encoded in parts as a cached one is: events added after an earlier head, and
+        // keys first used by the later events
+        SummaryRecord summary;
+        summary.gameName = "Germany_Japan";
+        summary.user = "user";
+        summary.teamA = report.team_a_name;
+        summary.teamB = report.team_b_name;
+        summary.evicted = 3;
+        EventKeyTable keys;
+        std::string events;
+        size_t half = report.events.size() / 2;
+        for (size_t i = 0; i < half; i++)
+        {
+            summary.stats.addEvent(report.events[i]);
+            encodeSummaryEvent(keys, report.events[i], events);
+        }
+        encodeSummaryHead(keys, summary.gameName, summary.user, summary.teamA, summary.teamB, summary.evicted,
+                          summary.stats);
+        for (size_t i = half; i < report.events.size(); i++)
+        {
+            summary.stats.addEvent(report.events[i]);
+            encodeSummaryEvent(keys, report.events[i], events);
+        }
+        summary.stats.generalStats = stats.generalStats;
+        summary.stats.teamAStats = stats.teamAStats;
+        summary.stats.teamBStats = stats.teamBStats;
+        std::string parts = encodeSummaryHead(keys, summary.gameName, summary.user, summary.teamA, summary.teamB,
+                                              summary.evicted, summary.stats) +
+                            events;
+        for (const std::string &encoded : {parts, encodeSummary(summary)})
+        {
+            SummaryRecord decodedSummary = decodeSummary(encoded);
+            check(decodedSummary.gameName == summary.gameName && decodedSummary.user == summary.user &&
+                      decodedSummary.teamA == summary.teamA && decodedSummary.teamB == summary.teamB &&
+                      decodedSummary.evicted == summary.evicted,
+                  "summary metadata of " + path);
+            check(decodedSummary.stats.generalStats == stats.generalStats &&
+                      decodedSummary.stats.teamAStats == stats.teamAStats &&
+                      decodedSummary.stats.teamBStats == stats.teamBStats,
+                  "summary stats maps of " + path);
+            check(sameEvents(report.events, decodedSummary.stats.events), "summary events of " + path);
+        }
+    }
+
+    void testEdgeCases()
+    {
+        for (int time : {0, -1, -90, 5400, INT_MIN, INT_MAX})
+        {
+            Event event = makeEvent("time", time, EventUpdates(), "");
+            check(decodeEvent(encodeEvent(event)).get_time() == time, "time " + std::to_string(time));
+        }
+
+        Event empty("", "", "", 0, EventUpdates(), EventUpdates(), EventUpdates(), "");
+        check(sameEvent(decodeEvent(encodeEvent(empty)), empty), "empty strings and maps");
+
+        GameStats noStats;
+        GameStats decoded = decodeGameStats(encodeGameStats(noStats));
+        check(decoded.generalStats.empty() && decoded.teamAStats.empty() && decoded.teamBStats.empty() &&
+                  decoded.events.empty(),
+              "empty game stats");
+
+        names_and_events noEvents("Team A", "Team B", std::vector<Event>());
+        names_and_events decodedReport = decodeReport(encodeReport(noEvents));
+        check(decodedReport.team_a_name == "Team A" && decodedReport.events.empty(), "report without events");
+
+        EventUpdates updates;
+        updates["binary\n\t\"key\""] = EventString("nul \0 byte", 10);
+        updates["long"] = EventString(100000, 'x');
+        Event odd = makeEvent("odd", 1, updates, EventString(300, '\xff'));
+        check(sameEvent(decodeEvent(encodeEvent(odd)), odd), "control characters, NUL and long values");
+    }
+
+    void testMalformed(const std::string &path)
+    {
+        names_and_events report = parseEventsFile(path);
+        std::string event = encodeEvent(report.events.front());
+        std::string stats;
+        {
+            GameStats gs;
+            gs.generalStats["active"] = "true";
+            gs.addEvent(report.events.front());
+            stats = encodeGameStats(gs);
+        }
+        std::string full = encodeReport(report);
+        SummaryRecord record;
+        record.gameName = "game";
+        record.stats.addEvent(report.events.front());
+        std::string summary = encodeSummary(record);
+
+        auto eventDecoder = [](const std::string &buffer) { decodeEvent(buffer); };
+        auto statsDecoder = [](const std::string &buffer) { decodeGameStats(buffer); };
+        auto reportDecoder = [](const std::string &buffer) { decodeReport(buffer); };
+        auto summaryDecoder = [](const std::string &buffer) { decodeSummary(buffer); };
+
+        for (size_t length = 0; length < event.size(); length++)
+            checkRejected(event.substr(0, length), eventDecoder, "event truncated to " + std::to_string(length) + " bytes");
+        for (size_t length = 0; length < stats.size(); length++)
+            checkRejected(stats.substr(0, length), statsDecoder, "game stats truncated to " + std::to_string(length) + " bytes");
+        for (size_t length = 0; length < summary.size(); length++)
+            checkRejected(summary.substr(0, length), summaryDecoder, "summary truncated to " + std::to_string(length) + " bytes");
+        for (size_t length = 0; length < full.size(); length += 97)
+            checkRejected(full.substr(0, length), reportDecoder, "report truncated to " + std::to_string(length) + " bytes");
+
+        std::string corrupt = event;
+        corrupt[0] = 'X';
+        checkRejected(corrupt, eventDecoder, "bad magic");
+        corrupt = event;
+        corrupt[4] = (char)(EVENT_CODEC_VERSION + 1);
+        checkRejected(corrupt, eventDecoder, "unsupported version");
+        checkRejected(event, statsDecoder, "event decoded as game stats");
+        checkRejected(stats, reportDecoder, "game stats decoded as a report");
+        checkRejected(stats, summaryDecoder, "game stats decoded as a summary");
+        checkRejected(event + "x", eventDecoder, "trailing bytes");
+
+        // an update key index past the key table: one key "k", general updates {key 1: ""}
+        std::string badIndex("SEVB", 4);
+        badIndex += (char)EVENT_CODEC_VERSION;
+        badIndex += (char)1;
+        badIndex += std::string("\x01\x01k", 3);
+        badIndex += std::string("\x00\x00\x00\x00", 4);
+        badIndex += std::string("\x01\x01\x00", 3);
+        badIndex += std::string("\x00\x00\x00", 3);
+        checkRejected(badIndex, eventDecoder, "key index out of range");
+
+        // a varint that never ends, as a string length
+        std::string endless = event.substr(0, 6) + std::string(12, '\xff');
+        checkRejected(endless, eventDecoder, "overlong varint");
+
+        // a length that runs past the end of the buffer
+        std::string longString = event.substr(0, 6) + std::string("\x00\x7f", 2) + "short";
+        checkRejected(longString, eventDecoder, "string length past the end");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        std::cout << "usage: " << argv[0] << " {events file}" << std::endl;
+        return 2;
+    }
+    try
+    {
+        testEventsFile(argv[1]);
+        testEdgeCases();
+        testMalformed(argv[1]);
+    }
+    catch (const std::exception &e)
+    {
+        check(false, std::string("unexpected exception: ") + e.what());
+    }
+    std::cout << "EventCodecTest: " << checks - failures << " of " << checks << " checks passed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}